@@ -45,6 +45,7 @@ char lifeGrid[64][48];
 char neighborCount[64][48];
 char cols_to_scan[64];
 char rows_to_scan[48];
+uint8_t mc_shadow[VDP_MC_SHADOW_SIZE];
 
 int16_t cursor_x_to_screen(int cursor_x) {
     int16_t offset = 32;
@@ -75,7 +76,7 @@ int countNeighbors(int x, int y) {
     int16_t neighbors = 0;
     if(x < 0 || x > (X_RES_PIXELS - 1)) return 0;
     if(y < 0 || y > (Y_RES_PIXELS - 1)) return 0;
-    vdp_sprite_set_position(sprite_handle, cursor_x_to_screen(x), cursor_y_to_screen(y));
+    vdp_sprite_move(sprite_handle, cursor_x_to_screen(x), cursor_y_to_screen(y));
 
     for (int xn = x - 1; xn <= x + 1; xn++) {
         for (int yn = y - 1; yn <= y + 1; yn++) {
@@ -104,9 +105,7 @@ void setRowsToScan(void) {
 }
 
 void plotRowsToScan(void) {
-    for (int y = 0; y < Y_RES_PIXELS; y++) {
-        vdp_plot_color(0, y, VDP_DARK_BLUE);
-    }
+    vdp_vline(0, 0, Y_RES_PIXELS, VDP_DARK_BLUE);
     // for(int idy=0; idy<Y_RES_PIXELS && rows_to_scan[idy] != (char) -1; idy++) {
     for (int y = 0; y < Y_RES_PIXELS; y++) {
         if (rows_to_scan[y]) {
@@ -127,9 +126,7 @@ void setColsToScan(void) {
     }
 }
 void plotColsToScan(void) {
-    for (int x = 0; x < 64; x++) {
-        vdp_plot_color(x, 0, VDP_DARK_BLUE);
-    }
+    vdp_hline(0, 0, X_RES_PIXELS, VDP_DARK_BLUE);
 
     for (int x = 0; x < 64; x++) {
         if (cols_to_scan[x]) {
@@ -186,12 +183,11 @@ void initGrid(void) {
 }
 
 void plotGrid(void) {
+    vdp_fill_rect(0, 0, X_RES_PIXELS, Y_RES_PIXELS, VDP_DARK_BLUE);
     for (int x = 0; x < X_RES_PIXELS; x++) {
         for (int y = 0; y < Y_RES_PIXELS; y++) {
             if (lifeGrid[x][y]) {
                 vdp_plot_color(x, y, VDP_LIGHT_YELLOW);
-            } else {
-                vdp_plot_color(x, y, VDP_DARK_BLUE);
             }
         }
     }
@@ -263,6 +259,7 @@ bool editGrid(void) {
     
     sprite_handle = vdp_sprite_init(0, 0, VDP_MAGENTA);
     while (shouldKeepEditing) {
+        vdp_flush();
         vdp_sprite_set_position(sprite_handle, cursor_x_to_screen(cursor_x),
                         cursor_y_to_screen(cursor_y));
         char key = getk();
@@ -311,17 +308,20 @@ int main(void) {
     char ch = 0;
     bool keepgoing = true;
     vdp_init(VDP_MODE_MULTICOLOR, VDP_BLACK, SPRITE_SMALL, false);
-    for (int i = 0; i < 256; i++) {
-        vdp_set_sprite_pattern(i, cursor_sprite_small);
-    }
+    vdp_set_multicolor_shadow(mc_shadow);
+    vdp_set_deferred(true);
+    vdp_set_sprite_pattern(0, cursor_sprite_small);
+    vdp_alias_sprite_patterns(0, 255, 0);
     sprite_handle = vdp_sprite_init(0, 0, VDP_WHITE);
 
     initGrid();
     plotGrid();
+    vdp_flush();
     editGrid();
 
     while (keepgoing == true) {
         vdp_plot_color(0, 0, VDP_CYAN);
+        vdp_flush();
         // z80_delay_ms(500);
     	// mysteriously crash Life by calling this
             ch = getk();     
@@ -333,10 +333,12 @@ int main(void) {
         }
         
         runGeneration();
+        vdp_sprite_commit();
         setRowsToScan();
         setColsToScan();
 
         plotColsToScan();
         plotRowsToScan();
+        vdp_flush();
     }
 }
@@ -24,10 +24,40 @@
 #include <arch/z80.h>
 #include <stdbool.h>
 #include "tms9918.h"
-#include "patterns.h"
-
+#ifdef VDP_HAS_FONT
+#if VDP_MODES_USED & VDP_USE_G2
+#include "patterns.h" // vdp_write() draws single characters from the font in Graphics II
+#else
+#include "patterns_packed.h"
+#endif
+#endif
+
+#if (VDP_MODES_USED & (VDP_MODES_USED - 1)) == 0
+// Only one mode compiled in, no need to look at _vdp_mode
+#define vdpModeIs(mode) VDP_HAS_MODE(mode)
+#else
+#define vdpModeIs(mode) (VDP_HAS_MODE(mode) && _vdp_mode == (mode))
+#endif
+
+#ifdef VDP_HAS_TEXT_BUFFER
 uint8_t _textBuffer[24 * 40]; // [row][col]
 
+// Console state, see vdp_console_write()
+bool _console_dirty[24];      // Rows of _textBuffer not yet written to VRAM
+uint8_t _console_pending = 0; // Number of rows set in _console_dirty
+uint8_t* _console_row;        // Start of the cursor row in _textBuffer
+uint8_t _console_escape = 0;  // 0: text, 1: after ESC, 2: in an ESC [ sequence
+uint8_t _console_params[4];
+uint8_t _console_param;
+uint8_t _console_frame;       // Frame count at the last vdp_console_flush()
+
+// VDP colors for the ANSI colors 30-37 and 90-97
+const uint8_t _ansi_colors[16] = {
+  VDP_BLACK, VDP_DARK_RED, VDP_MED_GREEN, VDP_DARK_YELLOW, VDP_DARK_BLUE, VDP_MAGENTA, VDP_CYAN, VDP_GRAY,
+  VDP_GRAY, VDP_LIGHT_RED, VDP_LIGHT_GREEN, VDP_LIGHT_YELLOW, VDP_LIGHT_BLUE, VDP_MAGENTA, VDP_CYAN, VDP_WHITE
+};
+#endif
+
 struct {
   uint8_t x;
   uint8_t y;
@@ -47,344 +77,2369 @@ uint8_t _vdp_mode;
 uint8_t _fgcolor;
 uint8_t _bgcolor;
 
+uint8_t* _mc_shadow = NULL; // RAM copy of the multicolor pattern table, see vdp_set_multicolor_shadow()
+uint8_t* _g2_shadow_pattern = NULL; // RAM copies of the Graphics II pattern and color tables, see vdp_set_g2_shadow()
+uint8_t* _g2_shadow_color = NULL;
+bool _g2_text_tiles = false;     // Font in pattern slots VDP_G2_FONT_SLOT-255, see vdp_set_g2_text_tiles()
+
+// Graphics II pixel rows whose patterns hold the font in tile text mode, bitmap drawing skips them
+#define isFontRow(y) (_g2_text_tiles && (((y) >> 3) & 7) >= VDP_G2_FONT_SLOT / 32)
+bool _vdp_deferred = false;      // Plots only update the shadow, see vdp_set_deferred()
+uint8_t _dirty_patterns[96];     // One bit per 8 byte pattern changed since the last vdp_flush()
+bool _vdp_double_buffer = false; // _pattern_table is the hidden page, see vdp_set_double_buffer()
+uint16_t _front_pattern_table;   // Pattern table currently displayed while double buffering
+uint8_t _dirty_presented[96];    // Patterns drawn on the front page but not yet on the back page
+
+uint8_t _vdp_registers[8];       // Last values written to the VDP registers
+
+// VRAM layout, see vdp_set_layout() and vdp_reserve()
+typedef struct {
+  const char* name;
+  uint16_t addr;
+  uint16_t size;
+} Vram_region;
+
+Vram_layout _vram_layout;                       // Table placement of the current mode
+Vram_layout _vram_requested;                    // Placement for the next vdp_init()
+bool _vram_custom_layout = false;
+Vram_region _vram_tables[5];                    // VRAM used by the tables of the current mode
+uint8_t _vram_table_count = 0;
+Vram_region _vram_regions[VDP_MAX_REGIONS];     // Reserved regions, sorted by address
+uint8_t _vram_region_count = 0;
+
+// Default table placement of each mode
+const Vram_layout _default_layouts[4] = {
+  {0x1400, 0x0800, 0x2000, 0x1000, 0x0000}, // Graphics I
+  {0x3800, 0x0000, 0x2000, 0x3B00, 0x1800}, // Graphics II
+  {0x1400, 0x0800, 0x0000, 0x3B00, 0x1800}, // Multicolor
+  {0x0800, 0x0000, 0x0000, 0x0000, 0x0000}  // Text
+};
+
+// Size of the name, pattern, color, sprite attribute and sprite pattern tables in each mode
+const uint16_t _table_sizes[4][5] = {
+  {768, 2048, 32, 128, 2048},
+  {768, 6144, 6144, 128, 2048},
+  {768, VDP_MC_SHADOW_SIZE, 0, 128, 2048},
+  {960, 2048, 0, 0, 0}
+};
+
+// Address bits of each table that the registers can not set
+const uint16_t _table_align[4][5] = {
+  {0x3FF, 0x7FF, 0x3F, 0x7F, 0x7FF},
+  {0x3FF, 0x1FFF, 0x1FFF, 0x7F, 0x7FF},
+  {0x3FF, 0x7FF, 0, 0x7F, 0x7FF},
+  {0x3FF, 0x7FF, 0, 0, 0}
+};
+
+// VDP interrupt service, see vdp_enable_interrupt()
+bool _vdp_irq_enabled = false;
+volatile uint8_t _vdp_status;    // Status register read by the interrupt handler
+volatile uint8_t _vdp_frames;    // Incremented by the interrupt handler once per frame
+void (*_vdp_frame_handler)(void) = NULL; // Called by the interrupt handler once per frame
+
+// Nonzero while the main program is between setting a VRAM address and transferring
+// the data. The interrupt handler leaves the queue alone until it is back to zero.
+volatile uint8_t _vdp_busy = 0;
+#define VDP_LOCK() _vdp_busy++
+#define VDP_UNLOCK() _vdp_busy--
+
+// Queue of commands run by the interrupt handler. Single producer (main program writes
+// _vdp_queue_head) and single consumer (interrupt handler writes _vdp_queue_tail), the
+// uint8_t indexes wrap around the 256 byte buffer on their own.
+#define VDP_CMD_REGISTER 1 // reg, value
+#define VDP_CMD_WRITE 2    // addr lo, addr hi, len, data[len]
+uint8_t _vdp_queue[256];
+volatile uint8_t _vdp_queue_head = 0;
+volatile uint8_t _vdp_queue_tail = 0;
+
+Sprite_attributes _sprite_attributes[32]; // RAM copy of the sprite attribute table
+uint8_t _sprite_dirty_first = 0xff;       // Entries changed since the last vdp_sprite_commit()
+uint8_t _sprite_dirty_last = 0;
+
+uint8_t _sprite_alias[256];                // Pattern shown for each sprite name, see vdp_alias_sprite_patterns()
+
+// Name byte of the sprite attributes for a sprite name
+#define spritePattern(name) (_sprite_size_sel ? 4 * _sprite_alias[name] : _sprite_alias[name])
+
+// Index of the sprite attribute table entry of a sprite handle
+#define spriteIndex(handle) (((handle) - _sprite_attribute_table) >> 2)
+
+// Logical sprites of the sprite multiplexer, see vdp_object_add()
+typedef struct {
+  uint16_t x;
+  uint8_t y;
+  uint8_t name;
+  uint8_t color;
+  bool active;
+} Sprite_object;
+
+Sprite_object _objects[VDP_MAX_OBJECTS];
+uint8_t _object_order[VDP_MAX_OBJECTS]; // Active objects, sorted by y in vdp_objects_update()
+uint8_t _object_count = 0;
+uint8_t _object_rotation = 0;           // Position in _object_order that gets sprite 0
+
+#ifdef VDP_C_KERNELS
+
 // Writes a byte to databus for register access
 void writePort(unsigned char value) {
 
   z80_outp(0xA1, value);
 }
 
-// Reads a byte from databus for register access
-uint8_t read_status_reg() {
-  return z80_inp(0xa1);
+// Reads a byte from databus for register access
+uint8_t read_status_reg() {
+  return z80_inp(0xa1);
+}
+
+// Writes a byte to databus for vram access
+void writeByteToVRAM(unsigned char value) {
+
+  z80_outp(0xA0, value);
+}
+
+// Reads a byte from databus for vram access
+unsigned char readByteFromVRAM() {
+  return z80_inp(0xa0);
+}
+
+// Offset of the vdp_plot_color() pixel (x,y) in the multicolor pattern or Graphics II color table
+uint16_t pixelOffset(uint8_t x, uint8_t y) {
+
+  return 8 * (x / 2) + y % 8 + 256 * (y / 8);
+}
+
+// Offset of the vdp_plot_hires() pixel (x,y) in the Graphics II pattern and color tables
+uint16_t hiresOffset(uint8_t x, uint8_t y) {
+
+  return 8 * (x / 8) + y % 8 + 256 * (y / 8);
+}
+
+#else
+
+// Assembly versions of the VDP access and address kernels. Single arguments come in L or HL
+// (__z88dk_fastcall), 8 bit results go back in both A and L to suit either SDCC calling convention.
+// T-states below include the call.
+
+// 42 T-states
+void writePort(unsigned char value) __naked VDP_FASTCALL {
+
+  __asm
+    ld a, l
+    out (0xA1), a
+    ret
+  __endasm;
+}
+
+// 42 T-states
+uint8_t read_status_reg() __naked {
+
+  __asm
+    in a, (0xA1)
+    ld l, a
+    ret
+  __endasm;
+}
+
+// 42 T-states
+void writeByteToVRAM(unsigned char value) __naked VDP_FASTCALL {
+
+  __asm
+    ld a, l
+    out (0xA0), a
+    ret
+  __endasm;
+}
+
+// 42 T-states
+unsigned char readByteFromVRAM() __naked {
+
+  __asm
+    in a, (0xA0)
+    ld l, a
+    ret
+  __endasm;
+}
+
+// The offsets need no tables, the TMS9918 layout is a shuffle of the coordinate bits:
+// high byte y / 8, low byte column * 8 + y % 8
+
+// Offset of the vdp_plot_color() pixel (x,y), passed as (y << 8) | x, 96 T-states
+uint16_t pixelOffsetXY(uint16_t xy) __naked VDP_FASTCALL {
+
+  __asm
+    ld a, h
+    and 7
+    ld c, a
+    ld a, l
+    and 0x3E
+    add a, a
+    add a, a
+    or c
+    ld l, a
+    ld a, h
+    rrca
+    rrca
+    rrca
+    and 0x1F
+    ld h, a
+    ret
+  __endasm;
+}
+
+// Offset of the vdp_plot_hires() pixel (x,y), passed as (y << 8) | x, 88 T-states
+uint16_t hiresOffsetXY(uint16_t xy) __naked VDP_FASTCALL {
+
+  __asm
+    ld a, h
+    and 7
+    ld c, a
+    ld a, l
+    and 0xF8
+    or c
+    ld l, a
+    ld a, h
+    rrca
+    rrca
+    rrca
+    and 0x1F
+    ld h, a
+    ret
+  __endasm;
+}
+
+#define pixelOffset(x, y) pixelOffsetXY(((uint16_t)(y) << 8) | (x))
+#define hiresOffset(x, y) hiresOffsetXY(((uint16_t)(y) << 8) | (x))
+
+#endif
+
+// Pattern byte bit of each pixel, indexed by x % 8
+const uint8_t _pixel_mask[8] = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
+
+// The two byte register and address writes are done with interrupts disabled, reading
+// the status register in the VDP interrupt handler would reset the address latch
+
+void setRegister(unsigned char registerIndex, unsigned char value) {
+
+  _vdp_registers[registerIndex & 7] = value;
+
+  __critical {
+    writePort(value);
+
+    writePort(0x80 | registerIndex);
+  }
+}
+
+#ifdef VDP_C_KERNELS
+
+void setWriteAddress(unsigned int address) {
+
+  __critical {
+    z80_outp(0xA1, address & 0xff);
+
+    z80_outp(0xa1, 0x40 | (address >> 8) & 0x3f);
+  }
+}
+
+void setReadAddress(unsigned int address) {
+
+  __critical {
+    z80_outp(0xA1, address & 0xff);
+
+    z80_outp(0xA1, (address >> 8) & 0x3f);
+  }
+}
+
+#else
+
+// Leaves interrupts as they were, ld a,i copies IFF2 to the parity flag. 114 T-states, 106 with interrupts off
+void setWriteAddress(unsigned int address) __naked VDP_FASTCALL {
+
+  __asm
+    ld a, i
+    push af
+    di
+    ld a, l
+    out (0xA1), a
+    ld a, h
+    and 0x3F
+    or 0x40
+    out (0xA1), a
+    pop af
+    ret po
+    ei
+    ret
+  __endasm;
+}
+
+// 107 T-states, 99 with interrupts off
+void setReadAddress(unsigned int address) __naked VDP_FASTCALL {
+
+  __asm
+    ld a, i
+    push af
+    di
+    ld a, l
+    out (0xA1), a
+    ld a, h
+    and 0x3F
+    out (0xA1), a
+    pop af
+    ret po
+    ei
+    ret
+  __endasm;
+}
+
+#endif
+
+// Block transfer arguments, handed to the assembly loops below through
+// globals so they do not depend on the compiler's calling convention
+const uint8_t* _blk_ptr;
+uint16_t _blk_len;
+uint8_t  _blk_value;
+
+// Each loop below takes 30-32 T-states per byte (~8.4us at 3.58 MHz), which
+// keeps the VDP's worst case VRAM access spacing during active display.
+// B counts bytes within a 256 byte block, D counts the blocks.
+
+void vdp_write_block(uint16_t addr, const uint8_t* src, uint16_t len) {
+
+  if (len == 0)
+    return;
+
+  VDP_LOCK();
+
+  setWriteAddress(addr);
+
+  _blk_ptr = src;
+  _blk_len = len;
+
+  __asm
+    ld hl, (__blk_ptr)
+    ld de, (__blk_len)
+    ld c, 0xA0
+    ld b, e
+    dec de
+    inc d
+  vdp_write_block_loop:
+    outi
+    nop
+    jp nz, vdp_write_block_loop
+    dec d
+    jp nz, vdp_write_block_loop
+  __endasm;
+
+  VDP_UNLOCK();
+}
+
+void vdp_stream_begin(uint16_t addr) {
+
+  VDP_LOCK();
+
+  setWriteAddress(addr);
+}
+
+void vdp_stream_end() {
+
+  VDP_UNLOCK();
+}
+
+void vdp_read_block(uint16_t addr, uint8_t* dst, uint16_t len) {
+
+  if (len == 0)
+    return;
+
+  VDP_LOCK();
+
+  setReadAddress(addr);
+
+  _blk_ptr = dst;
+  _blk_len = len;
+
+  __asm
+    ld hl, (__blk_ptr)
+    ld de, (__blk_len)
+    ld c, 0xA0
+    ld b, e
+    dec de
+    inc d
+  vdp_read_block_loop:
+    ini
+    nop
+    jp nz, vdp_read_block_loop
+    dec d
+    jp nz, vdp_read_block_loop
+  __endasm;
+
+  VDP_UNLOCK();
+}
+
+void vdp_fill(uint16_t addr, uint8_t value, uint16_t len) {
+
+  if (len == 0)
+    return;
+
+  VDP_LOCK();
+
+  setWriteAddress(addr);
+
+  _blk_value = value;
+  _blk_len = len;
+
+  __asm
+    ld a, (__blk_value)
+    ld de, (__blk_len)
+    ld b, e
+    dec de
+    inc d
+  vdp_fill_loop:
+    out (0xA0), a
+    nop
+    nop
+    djnz vdp_fill_loop
+    dec d
+    jp nz, vdp_fill_loop
+  __endasm;
+
+  VDP_UNLOCK();
+}
+
+// Reads an LZ4 length extension, each byte adds to the length until one is not 255
+uint16_t readLength(const uint8_t** in) {
+
+  uint16_t len = 0;
+  uint8_t value;
+
+  do {
+    value = *(*in)++;
+    len += value;
+  } while (value == 255);
+
+  return len;
+}
+
+void vdp_decompress_to_vram(uint16_t addr, const uint8_t* packed) {
+
+  uint16_t end = addr + (packed[0] | (packed[1] << 8));
+  const uint8_t* in = packed + 2;
+  uint8_t buffer[16];
+
+  while (addr != end) {
+
+    uint8_t token = *in++;
+    uint16_t len = token >> 4;
+
+    if (len == 15)
+      len += readLength(&in);
+
+    vdp_write_block(addr, in, len);
+
+    in += len;
+    addr += len;
+
+    // The last sequence has no match
+    if (addr == end)
+      break;
+
+    uint16_t offset = in[0] | (in[1] << 8);
+    in += 2;
+
+    len = (token & 0x0F) + 4;
+
+    if ((token & 0x0F) == 15)
+      len += readLength(&in);
+
+    uint16_t from = addr - offset;
+
+    // Copy the match from the bytes already in VRAM, a few at a time so that a
+    // chunk never reads bytes it is about to write itself
+    if (offset == 1) {
+
+      vdp_read_block(from, buffer, 1);
+      vdp_fill(addr, buffer[0], len);
+
+      addr += len;
+    } else {
+
+      while (len != 0) {
+
+        uint8_t chunk = (len < sizeof(buffer)) ? len : sizeof(buffer);
+
+        if (chunk > offset)
+          chunk = offset;
+
+        vdp_read_block(from, buffer, chunk);
+        vdp_write_block(addr, buffer, chunk);
+
+        from += chunk;
+        addr += chunk;
+        len -= chunk;
+      }
+    }
+  }
+}
+
+bool overlaps(uint16_t a, uint16_t a_size, uint16_t b, uint16_t b_size) {
+
+  return a < b + b_size && b < a + a_size;
+}
+
+// Returns the table or reserved region that uses any of the size bytes at addr, NULL if they are free
+const Vram_region* usedAt(uint16_t addr, uint16_t size) {
+
+  for (uint8_t i = 0; i < _vram_table_count; i++)
+    if (overlaps(addr, size, _vram_tables[i].addr, _vram_tables[i].size))
+      return &_vram_tables[i];
+
+  for (uint8_t i = 0; i < _vram_region_count; i++)
+    if (overlaps(addr, size, _vram_regions[i].addr, _vram_regions[i].size))
+      return &_vram_regions[i];
+
+  return NULL;
+}
+
+// Fills _vram_tables with the tables mode places at layout, returns VDP_ERROR if they are misaligned or overlap
+int setTables(uint8_t mode, const Vram_layout* layout) {
+
+  const uint16_t* addr = &layout->name_table;
+
+  _vram_table_count = 0;
+
+  for (uint8_t i = 0; i < 5; i++) {
+
+    uint16_t size = _table_sizes[mode][i];
+
+    if (size == 0)
+      continue;
+
+    if ((addr[i] & _table_align[mode][i]) != 0 || addr[i] + size > 0x4000 || usedAt(addr[i], size) != NULL) {
+
+      _vram_table_count = 0;
+
+      return VDP_ERROR;
+    }
+
+    _vram_tables[_vram_table_count].addr = addr[i];
+    _vram_tables[_vram_table_count].size = size;
+    _vram_table_count++;
+  }
+
+  return VDP_OK;
+}
+
+// Points the VDP and the table globals at _vram_layout
+void applyLayout(uint8_t mode) {
+
+  _name_table = _vram_layout.name_table;
+  _pattern_table = _vram_layout.pattern_table;
+  _color_table = _vram_layout.color_table;
+  _sprite_attribute_table = _vram_layout.sprite_attribute_table;
+  _sprite_pattern_table = _vram_layout.sprite_pattern_table;
+
+  setRegister(2, _name_table >> 10);
+
+  if (mode == VDP_MODE_G2) {
+
+    // The low bits mask the address of each third of the screen and must be set
+    setRegister(3, (_color_table >> 6) | 0x7F);
+    setRegister(4, (_pattern_table >> 11) | 0x03);
+  } else {
+
+    setRegister(3, _color_table >> 6);
+    setRegister(4, _pattern_table >> 11);
+  }
+
+  setRegister(5, _sprite_attribute_table >> 7);
+  setRegister(6, _sprite_pattern_table >> 11);
+}
+
+// Clears all VRAM outside the reserved regions
+void clearUnreserved() {
+
+  uint16_t addr = 0;
+
+  for (uint8_t i = 0; i < _vram_region_count; i++) {
+
+    vdp_fill(addr, 0, _vram_regions[i].addr - addr);
+
+    addr = _vram_regions[i].addr + _vram_regions[i].size;
+  }
+
+  vdp_fill(addr, 0, 0x4000 - addr);
+}
+
+int vdp_set_layout(const Vram_layout* layout) {
+
+  _vram_custom_layout = layout != NULL;
+
+  if (layout != NULL)
+    _vram_requested = *layout;
+
+  return VDP_OK;
+}
+
+void vdp_default_layout(uint8_t mode, Vram_layout* layout) {
+
+  *layout = _default_layouts[mode & 3];
+}
+
+int vdp_reserve(const char* name, uint16_t addr, uint16_t size) {
+
+  if (size == 0 || addr + size > 0x4000 || _vram_region_count == VDP_MAX_REGIONS || usedAt(addr, size) != NULL)
+    return VDP_ERROR;
+
+  uint8_t i = _vram_region_count++;
+
+  for (; i > 0 && _vram_regions[i - 1].addr > addr; i--)
+    _vram_regions[i] = _vram_regions[i - 1];
+
+  _vram_regions[i].name = name;
+  _vram_regions[i].addr = addr;
+  _vram_regions[i].size = size;
+
+  return VDP_OK;
+}
+
+uint16_t vdp_alloc(const char* name, uint16_t size, uint16_t align) {
+
+  if (size == 0 || align == 0)
+    return VDP_NO_REGION;
+
+  const Vram_region* used;
+
+  // Try the first aligned address after each table or region in the way
+  for (uint16_t addr = 0;; addr = used->addr + used->size) {
+
+    addr = (addr + align - 1) & ~(align - 1);
+
+    if (addr + size > 0x4000)
+      return VDP_NO_REGION;
+
+    used = usedAt(addr, size);
+
+    if (used == NULL) {
+
+      vdp_reserve(name, addr, size);
+
+      return addr;
+    }
+  }
+}
+
+uint16_t vdp_region(const char* name) {
+
+  for (uint8_t i = 0; i < _vram_region_count; i++)
+    if (strcmp(_vram_regions[i].name, name) == 0)
+      return _vram_regions[i].addr;
+
+  return VDP_NO_REGION;
+}
+
+void vdp_release(const char* name) {
+
+  for (uint8_t i = 0; i < _vram_region_count; i++) {
+
+    if (strcmp(_vram_regions[i].name, name) != 0)
+      continue;
+
+    _vram_region_count--;
+
+    for (; i < _vram_region_count; i++)
+      _vram_regions[i] = _vram_regions[i + 1];
+
+    return;
+  }
+}
+
+// Writes the multicolor name table with pattern column col of pattern row row at the top left, wrapping around
+void mcNameTable(uint8_t col, uint8_t row) {
+
+  uint8_t names[32];
+  uint16_t addr = _name_table;
+
+  for (uint8_t j = 0; j < 6; j++) {
+
+    uint8_t first = row << 5;
+
+    for (uint8_t i = 0; i < 32; i++)
+      names[i] = first + ((col + i) & 31);
+
+    // A pattern covers 4 name rows, each showing the next 2 of its bytes
+    for (uint8_t k = 0; k < 4; k++, addr += 32)
+      vdp_write_block(addr, names, 32);
+
+    if (++row == VDP_MC_ROWS)
+      row = 0;
+  }
+}
+
+// Puts the tables in tables back to how vdp_init() leaves them, their VRAM must already be cleared
+void resetTables(uint8_t tables) {
+
+  if (tables & VDP_TABLE_NAME) {
+
+    if (vdpModeIs(VDP_MODE_G2)) {
+
+      setWriteAddress(_name_table);
+
+      for (uint16_t i = 0; i < 768; i++)
+        writeByteToVRAM(i);
+    } else if (vdpModeIs(VDP_MODE_MULTICOLOR)) {
+
+      mcNameTable(0, 0);
+    }
+#if VDP_MODES_USED & VDP_USE_TEXT
+    else if (vdpModeIs(VDP_MODE_TEXT)) {
+
+      memset(_textBuffer, 0x20, 23 * 40);
+
+      vdp_set_cursor2(0, 0);
+    }
+#endif
+  }
+
+  if (tables & VDP_TABLE_PATTERN) {
+
+#if VDP_MODES_USED & (VDP_USE_G1 | VDP_USE_TEXT)
+    // Initialize pattern table with ASCII patterns
+    if (vdpModeIs(VDP_MODE_G1) || vdpModeIs(VDP_MODE_TEXT))
+#if VDP_MODES_USED & VDP_USE_G2
+      vdp_write_block(_pattern_table + 0x100, ASCII, 768);
+#else
+      vdp_decompress_to_vram(_pattern_table + 0x100, ASCII_packed);
+#endif
+#endif
+
+    if (vdpModeIs(VDP_MODE_MULTICOLOR) && _mc_shadow != NULL)
+      memset(_mc_shadow, 0, VDP_MC_SHADOW_SIZE);
+
+    if (vdpModeIs(VDP_MODE_G2) && _g2_shadow_pattern != NULL)
+      memset(_g2_shadow_pattern, 0, VDP_G2_SHADOW_SIZE);
+  }
+
+  if ((tables & VDP_TABLE_COLOR) && vdpModeIs(VDP_MODE_G2) && _g2_shadow_color != NULL)
+    memset(_g2_shadow_color, 0, VDP_G2_SHADOW_SIZE);
+
+  // The font of tile text is gone
+  if (tables & (VDP_TABLE_NAME | VDP_TABLE_PATTERN | VDP_TABLE_COLOR))
+    _g2_text_tiles = false;
+
+  if (tables & (VDP_TABLE_PATTERN | VDP_TABLE_COLOR)) {
+
+    memset(_dirty_patterns, 0, sizeof(_dirty_patterns));
+
+    // The shown page still has the old patterns, vdp_begin_frame() copies the cleared shadow over them
+    if (_vdp_double_buffer)
+      memset(_dirty_presented, 0xFF, sizeof(_dirty_presented));
+  }
+
+  if (tables & VDP_TABLE_SPRITE_ATTRIBUTES) {
+
+    memset(_sprite_attributes, 0, sizeof(_sprite_attributes));
+    _sprite_dirty_first = 0xff;
+    _sprite_dirty_last = 0;
+
+    memset(_objects, 0, sizeof(_objects));
+    _object_count = 0;
+    _object_rotation = 0;
+  }
+
+  if (tables & VDP_TABLE_SPRITE_PATTERNS) {
+
+    uint8_t name = 0;
+
+    do {
+      _sprite_alias[name] = name;
+    } while (++name != 0);
+  }
+}
+
+void vdp_clear_tables(uint8_t tables) {
+
+  const uint16_t addr[5] = {_name_table, _pattern_table, _color_table, _sprite_attribute_table, _sprite_pattern_table};
+
+  VDP_LOCK();
+
+  for (uint8_t i = 0; i < 5; i++)
+    if (tables & (1 << i))
+      vdp_fill(addr[i], 0, _table_sizes[_vdp_mode][i]);
+
+  resetTables(tables);
+
+  VDP_UNLOCK();
+}
+
+int vdp_init(uint8_t mode, uint8_t color, bool big_sprites, bool magnify) {
+
+  return vdp_reconfigure(mode, color, big_sprites, magnify, VDP_TABLE_ALL);
+}
+
+int vdp_reconfigure(uint8_t mode, uint8_t color, bool big_sprites, bool magnify, uint8_t tables) {
+
+  if (mode > VDP_MODE_TEXT || !VDP_HAS_MODE(mode))
+    return VDP_ERROR; // Unsupported mode
+
+  // The double buffering back page belongs to the old layout
+  if (_vdp_double_buffer)
+    vdp_release(VDP_BACK_PAGE);
+
+  _vdp_double_buffer = false;
+
+  const Vram_layout* layout = _vram_custom_layout ? &_vram_requested : &_default_layouts[mode];
+
+  // Tables must not overlap each other or the reserved regions
+  if (setTables(mode, layout) != VDP_OK) {
+
+    setTables(_vdp_mode, &_vram_layout);
+
+    return VDP_ERROR;
+  }
+
+  _vram_layout = *layout;
+
+  _vdp_mode = mode;
+
+  _sprite_size_sel = big_sprites;
+
+  VDP_LOCK();
+
+  // Commands queued for the previous mode no longer apply
+  _vdp_queue_tail = _vdp_queue_head;
+
+  _g2_text_tiles = false;
+
+#ifdef VDP_HAS_TEXT_BUFFER
+  // Rows of the previous mode's console are not written into the new tables
+  memset(_console_dirty, false, sizeof(_console_dirty));
+  _console_pending = 0;
+#endif
+
+  switch (mode) {
+#if VDP_MODES_USED & VDP_USE_G1
+  case VDP_MODE_G1:
+
+    setRegister(0, 0x00);
+    setRegister(1, 0xC0 | (big_sprites << 1) | magnify); // Ram size 16k, activate video output
+    _color_table_size = 32;
+
+    break;
+#endif
+
+#if VDP_MODES_USED & VDP_USE_G2
+  case VDP_MODE_G2:
+
+    setRegister(0, 0x02);
+    setRegister(1, 0xC0 | (big_sprites << 1) | magnify); // Ram size 16k, Disable Int, 16x16 Sprites, mag off, activate video output
+    _color_table_size = 0x1800;
+
+    break;
+#endif
+
+#if VDP_MODES_USED & VDP_USE_TEXT
+  case VDP_MODE_TEXT:
+
+    setRegister(0, 0x00);
+    setRegister(1, 0xD2); // Ram size 16k, Disable Int
+    _crsr_max_x = 39;
+
+    break;
+#endif
+
+#if VDP_MODES_USED & VDP_USE_MULTICOLOR
+  case VDP_MODE_MULTICOLOR:
+
+    setRegister(0, 0x00);
+    setRegister(1, 0xC8 | (big_sprites << 1) | magnify); // Ram size 16k, Multicolor
+
+    break;
+#endif
+
+  }
+
+  applyLayout(mode);
+
+  setRegister(7, color);
+
+  if (_vdp_irq_enabled)
+    setRegister(1, _vdp_registers[1] | R1_IE);
+
+  if (tables == VDP_TABLE_ALL) {
+
+    // Clear Ram, reserved regions keep what was loaded into them
+    clearUnreserved();
+
+    resetTables(tables);
+  } else {
+
+    vdp_clear_tables(tables);
+  }
+
+  VDP_UNLOCK();
+
+  return VDP_OK;
+}
+
+void vdp_dumpFontToScreen() {
+
+  for (uint8_t j = 0; j < 24; j++)
+    for (uint16_t i = 0; i < 32; i++)
+      writeByteToVRAM(i + 32 * (j / 4));
+}
+
+void vdp_colorize(uint8_t fg, uint8_t bg) {
+
+  // Tile text shares one pattern per character, see vdp_textcolor()
+  if (!vdpModeIs(VDP_MODE_G2) || _g2_text_tiles)
+    return;
+
+  uint16_t name_offset = cursor.y * (_crsr_max_x + 1) + cursor.x; // Position in name table
+  uint16_t color_offset = name_offset << 3;                       // Offset of pattern in pattern table
+
+  vdp_fill(_color_table + color_offset, (fg << 4) + bg, 8);
+}
+
+// Marks the 8 byte pattern holding offset in a dirty pattern bitmap
+void markDirty(uint8_t* bitmap, uint16_t offset) {
+
+  bitmap[offset >> 6] |= _pixel_mask[(offset >> 3) & 7];
+}
+
+#if VDP_MODES_USED & VDP_USE_G2
+void vdp_plot_hires(uint8_t x, uint8_t y, uint8_t color1, uint8_t color2) {
+
+  if (isFontRow(y))
+    return;
+
+  uint16_t offset = hiresOffset(x, y);
+  uint8_t pixel, color;
+
+  if (_g2_shadow_pattern != NULL) {
+
+    pixel = _g2_shadow_pattern[offset];
+    color = _g2_shadow_color[offset];
+  } else {
+
+    VDP_LOCK();
+    setReadAddress(_pattern_table + offset);
+    pixel = readByteFromVRAM();
+    setReadAddress(_color_table + offset);
+    color = readByteFromVRAM();
+    VDP_UNLOCK();
+  }
+
+  if (color1 != NULL) {
+
+    pixel |= _pixel_mask[x & 7]; //Set a "1"
+    color = (color & 0x0F) | (color1 << 4);
+  } else {
+
+    pixel &= ~_pixel_mask[x & 7]; //Set bit as "0"
+    color = (color & 0xF0) | (color2 & 0x0F);
+  }
+
+  if (_g2_shadow_pattern != NULL) {
+
+    _g2_shadow_pattern[offset] = pixel;
+    _g2_shadow_color[offset] = color;
+
+    if (_vdp_deferred) {
+
+      markDirty(_dirty_patterns, offset);
+
+      return;
+    }
+  }
+
+  VDP_LOCK();
+  setWriteAddress(_pattern_table + offset);
+  writeByteToVRAM(pixel);
+  setWriteAddress(_color_table + offset);
+  writeByteToVRAM(color);
+  VDP_UNLOCK();
+}
+#endif
+
+#ifdef VDP_C_KERNELS
+
+void vdp_plot_color(uint8_t x, uint8_t y, uint8_t color) {
+
+  if (vdpModeIs(VDP_MODE_MULTICOLOR)) {
+
+    uint16_t offset = pixelOffset(x, y);
+    uint8_t dot;
+
+    if (_mc_shadow != NULL) {
+
+      dot = _mc_shadow[offset];
+    } else {
+
+      VDP_LOCK();
+      setReadAddress(_pattern_table + offset);
+      dot = readByteFromVRAM();
+      VDP_UNLOCK();
+    }
+
+    if (x & 1) // Odd columns
+      dot = (dot & 0xF0) + (color & 0x0f);
+    else
+      dot = (dot & 0x0F) + (color << 4);
+
+    if (_mc_shadow != NULL) {
+
+      _mc_shadow[offset] = dot;
+
+      if (_vdp_deferred) {
+
+        markDirty(_dirty_patterns, offset);
+
+        return;
+      }
+
+      if (_vdp_double_buffer)
+        markDirty(_dirty_presented, offset);
+    }
+
+    VDP_LOCK();
+    setWriteAddress(_pattern_table + offset);
+    writeByteToVRAM(dot);
+    VDP_UNLOCK();
+  } else if (vdpModeIs(VDP_MODE_G2)) {
+
+    if (isFontRow(y))
+      return;
+
+    // Draw bitmap
+    uint16_t offset = pixelOffset(x, y);
+    uint8_t color_;
+
+    if (_g2_shadow_color != NULL) {
+
+      color_ = _g2_shadow_color[offset];
+    } else {
+
+      VDP_LOCK();
+      setReadAddress(_color_table + offset);
+      color_ = readByteFromVRAM();
+      VDP_UNLOCK();
+    }
+
+    if ((x & 1) == 0) //Even 
+    {
+
+      color_ &= 0x0F;
+      color_ |= (color << 4);
+    } else {
+
+      color_ &= 0xF0;
+      color_ |= color & 0x0F;
+    }
+
+    if (_g2_shadow_color != NULL) {
+
+      _g2_shadow_pattern[offset] = 0xF0;
+      _g2_shadow_color[offset] = color_;
+
+      if (_vdp_deferred) {
+
+        markDirty(_dirty_patterns, offset);
+
+        return;
+      }
+    }
+
+    VDP_LOCK();
+    setWriteAddress(_pattern_table + offset);
+    writeByteToVRAM(0xF0);
+    setWriteAddress(_color_table + offset);
+    writeByteToVRAM(color_);
+    VDP_UNLOCK();
+    // Colorize
+  }
+}
+#else
+
+uint8_t _plot_color; // Color argument of plotColorXY(), see vdp_plot_color()
+
+// vdp_plot_color() of the pixel (x,y), passed as (y << 8) | x, with the color in _plot_color.
+// T-states including the call for even columns (odd ones take 16 less), with the RAM shadow: 609 in
+// multicolor, 865 in Graphics II. Without it the old byte is read from VRAM under the same lock: 620 and 886.
+void plotColorXY(uint16_t xy) __naked VDP_FASTCALL {
+
+  __asm
+    ld d, h
+    ld e, l
+
+    ; Offset, the same shuffle as pixelOffsetXY()
+    ld a, h
+    and 7
+    ld c, a
+    ld a, l
+    and 0x3E
+    add a, a
+    add a, a
+    or c
+    ld l, a
+    ld a, h
+    rrca
+    rrca
+    rrca
+    and 0x1F
+    ld h, a
+
+    ; B: bits to keep, C: the new nibble. Even columns are the high nibble
+    ld a, (__plot_color)
+    bit 0, e
+    jr nz, plotColorXY_odd
+    add a, a
+    add a, a
+    add a, a
+    add a, a
+    ld c, a
+    ld b, 0x0F
+    jr plotColorXY_mode
+  plotColorXY_odd:
+    and 0x0F
+    ld c, a
+    ld b, 0xF0
+
+  plotColorXY_mode:
+    ld a, (__vdp_mode)
+#if VDP_MODES_USED & VDP_USE_G2
+    cp 1 ; VDP_MODE_G2
+    jp z, plotColorXY_g2
+#endif
+#if VDP_MODES_USED & VDP_USE_MULTICOLOR
+    cp 2 ; VDP_MODE_MULTICOLOR
+    jr z, plotColorXY_mc
+#endif
+    ret
+
+#if VDP_MODES_USED & VDP_USE_MULTICOLOR
+  plotColorXY_mc:
+    ld de, (__mc_shadow)
+    ld a, d
+    or e
+    jr z, plotColorXY_mc_vram
+
+    push hl
+    add hl, de
+    ld a, (hl)
+    and b
+    or c
+    ld (hl), a
+    ld c, a
+    pop hl
+
+    ld a, (__vdp_deferred)
+    or a
+    ld de, __dirty_patterns
+    jp nz, plotColorXY_mark
+
+    ld a, (__vdp_double_buffer)
+    or a
+    jr z, plotColorXY_mc_write
+
+    push hl
+    push bc
+    ld de, __dirty_presented
+    call plotColorXY_mark
+    pop bc
+    pop hl
+
+  plotColorXY_mc_write:
+    ld de, (__pattern_table)
+    add hl, de
+    ld a, (__vdp_busy)
+    inc a
+    ld (__vdp_busy), a
+    jp plotColorXY_out
+
+  plotColorXY_mc_vram:
+    ld de, (__pattern_table)
+    add hl, de
+    ld a, (__vdp_busy)
+    inc a
+    ld (__vdp_busy), a
+    call _setReadAddress
+    in a, (0xA0)
+    and b
+    or c
+    ld c, a
+    jp plotColorXY_out
+#endif
+
+#if VDP_MODES_USED & VDP_USE_G2
+  plotColorXY_g2:
+    ; Rows of the font patterns in tile text mode, see isFontRow()
+    ld a, (__g2_text_tiles)
+    or a
+    jr z, plotColorXY_g2_bitmap
+    ld a, d
+    rrca
+    rrca
+    rrca
+    and 7
+    cp VDP_G2_FONT_SLOT / 32
+    ret nc
+
+  plotColorXY_g2_bitmap:
+    ld de, (__g2_shadow_color)
+    ld a, d
+    or e
+    jr z, plotColorXY_g2_vram
+
+    push hl
+    add hl, de
+    ld a, (hl)
+    and b
+    or c
+    ld (hl), a
+    ld c, a
+    pop hl
+    push hl
+    ld de, (__g2_shadow_pattern)
+    add hl, de
+    ld (hl), 0xF0
+    pop hl
+
+    ld a, (__vdp_deferred)
+    or a
+    ld de, __dirty_patterns
+    jr nz, plotColorXY_mark
+
+    ld a, (__vdp_busy)
+    inc a
+    ld (__vdp_busy), a
+    jr plotColorXY_g2_write
+
+  plotColorXY_g2_vram:
+    push hl
+    ld de, (__color_table)
+    add hl, de
+    ld a, (__vdp_busy)
+    inc a
+    ld (__vdp_busy), a
+    call _setReadAddress
+    in a, (0xA0)
+    and b
+    or c
+    ld c, a
+    pop hl
+
+  plotColorXY_g2_write:
+    ; The plot_color pixels show the color table through a 0xF0 pattern
+    push hl
+    ld de, (__pattern_table)
+    add hl, de
+    call _setWriteAddress
+    ld a, 0xF0
+    out (0xA0), a
+    pop hl
+    ld de, (__color_table)
+    add hl, de
+#endif
+
+    ; Writes C to VRAM address HL and releases the lock
+  plotColorXY_out:
+    call _setWriteAddress
+    ld a, c
+    out (0xA0), a
+    ld a, (__vdp_busy)
+    dec a
+    ld (__vdp_busy), a
+    ret
+
+    ; markDirty() of bitmap DE for offset HL: bitmap[offset >> 6] |= _pixel_mask[(offset >> 3) & 7]
+  plotColorXY_mark:
+    ld a, l
+    rrca
+    rrca
+    rrca
+    and 7
+    ld b, a
+    ld a, l
+    rlca
+    rlca
+    and 3
+    ld c, a
+    ld a, h
+    add a, a
+    add a, a
+    or c
+    add a, e
+    ld e, a
+    adc a, d
+    sub e
+    ld d, a
+    ld hl, __pixel_mask
+    ld a, b
+    add a, l
+    ld l, a
+    adc a, h
+    sub l
+    ld h, a
+    ld a, (de)
+    or (hl)
+    ld (de), a
+    ret
+  __endasm;
+}
+
+void vdp_plot_color(uint8_t x, uint8_t y, uint8_t color) {
+
+  _plot_color = color;
+
+  plotColorXY(((uint16_t)y << 8) | x);
+}
+
+#endif
+
+// Sets lines y0 to y1 (within one 8 line band) of the byte column bx to value, keeping the bits in keep
+void fillSpan(uint8_t bx, uint8_t y0, uint8_t y1, uint8_t keep, uint8_t value) {
+
+  uint16_t offset = pixelOffset(bx << 1, y0);
+  uint8_t len = y1 - y0 + 1;
+  uint16_t table = _pattern_table;
+  uint8_t* shadow = _mc_shadow;
+  uint8_t buffer[8];
+  uint8_t* bytes = buffer;
+
+  // Graphics II draws the colors of the plot_color pixels through the color table
+  if (vdpModeIs(VDP_MODE_G2)) {
+
+    if (isFontRow(y0))
+      return;
+
+    table = _color_table;
+    shadow = _g2_shadow_color;
+  }
+
+  if (shadow != NULL) {
+
+    bytes = shadow + offset;
+
+    if (vdpModeIs(VDP_MODE_G2) && _g2_shadow_pattern != NULL)
+      memset(_g2_shadow_pattern + offset, 0xF0, len);
+  } else if (keep != 0) {
+
+    vdp_read_block(table + offset, buffer, len);
+  }
+
+  for (uint8_t i = 0; i < len; i++)
+    bytes[i] = (bytes[i] & keep) | value;
+
+  if (shadow != NULL) {
+
+    if (_vdp_deferred) {
+
+      markDirty(_dirty_patterns, offset);
+
+      return;
+    }
+
+    if (_vdp_double_buffer)
+      markDirty(_dirty_presented, offset);
+  }
+
+  if (vdpModeIs(VDP_MODE_G2))
+    vdp_fill(_pattern_table + offset, 0xF0, len);
+
+  vdp_write_block(table + offset, bytes, len);
+}
+
+void vdp_fill_rect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t color) {
+
+  if (width == 0 || height == 0)
+    return;
+
+  if (!vdpModeIs(VDP_MODE_MULTICOLOR) && !vdpModeIs(VDP_MODE_G2))
+    return;
+
+  uint8_t x1 = x + width - 1;
+  uint8_t y1 = y + height - 1;
+  uint8_t both = (color << 4) | (color & 0x0F);
+
+  for (uint8_t bx = x >> 1; bx <= (x1 >> 1); bx++) {
+
+    uint8_t keep = 0;
+
+    if (bx == (x >> 1) && (x & 1))
+      keep |= 0xF0; // Starts on an odd column, keep the even one
+
+    if (bx == (x1 >> 1) && !(x1 & 1))
+      keep |= 0x0F; // Ends on an even column, keep the odd one
+
+    // One run of auto-incremented writes per pattern
+    for (uint8_t y0 = y;; y0++) {
+
+      uint8_t end = y0 | 7;
+
+      if (end > y1)
+        end = y1;
+
+      fillSpan(bx, y0, end, keep, both & ~keep);
+
+      if (end == y1)
+        break;
+
+      y0 = end;
+    }
+  }
+}
+
+void vdp_hline(uint8_t x, uint8_t y, uint8_t width, uint8_t color) {
+
+  vdp_fill_rect(x, y, width, 1, color);
+}
+
+void vdp_vline(uint8_t x, uint8_t y, uint8_t height, uint8_t color) {
+
+  vdp_fill_rect(x, y, 1, height, color);
+}
+
+#if VDP_MODES_USED & VDP_USE_G2
+// Sets the bits in mask of lines y0 to y1 (within one 8 line band) of the byte column bx like vdp_plot_hires()
+void hiresSpan(uint8_t bx, uint8_t y0, uint8_t y1, uint8_t mask, uint8_t color1, uint8_t color2) {
+
+  if (isFontRow(y0))
+    return;
+
+  uint16_t offset = hiresOffset(bx << 3, y0);
+  uint8_t len = y1 - y0 + 1;
+  uint8_t pattern_buffer[8];
+  uint8_t color_buffer[8];
+  uint8_t* pattern = pattern_buffer;
+  uint8_t* color = color_buffer;
+
+  if (mask == 0xFF) {
+
+    // Whole bytes show nothing of their old pattern or color, so there is nothing to read
+    uint8_t bits = (color1 != NULL) ? 0xFF : 0x00;
+    uint8_t both = (color1 << 4) | (color2 & 0x0F);
+
+    if (_g2_shadow_pattern != NULL) {
+
+      memset(_g2_shadow_pattern + offset, bits, len);
+      memset(_g2_shadow_color + offset, both, len);
+
+      if (_vdp_deferred) {
+
+        markDirty(_dirty_patterns, offset);
+
+        return;
+      }
+    }
+
+    vdp_fill(_pattern_table + offset, bits, len);
+    vdp_fill(_color_table + offset, both, len);
+
+    return;
+  }
+
+  if (_g2_shadow_pattern != NULL) {
+
+    pattern = _g2_shadow_pattern + offset;
+    color = _g2_shadow_color + offset;
+  } else {
+
+    vdp_read_block(_pattern_table + offset, pattern, len);
+    vdp_read_block(_color_table + offset, color, len);
+  }
+
+  for (uint8_t i = 0; i < len; i++) {
+
+    if (color1 != NULL) {
+
+      pattern[i] |= mask;
+      color[i] = (color[i] & 0x0F) | (color1 << 4);
+    } else {
+
+      pattern[i] &= ~mask;
+      color[i] = (color[i] & 0xF0) | (color2 & 0x0F);
+    }
+  }
+
+  if (_g2_shadow_pattern != NULL && _vdp_deferred) {
+
+    markDirty(_dirty_patterns, offset);
+
+    return;
+  }
+
+  vdp_write_block(_pattern_table + offset, pattern, len);
+  vdp_write_block(_color_table + offset, color, len);
+}
+
+void vdp_fill_rect_hires(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t color1, uint8_t color2) {
+
+  if (width == 0 || height == 0 || !vdpModeIs(VDP_MODE_G2))
+    return;
+
+  uint8_t x1 = x + width - 1;
+  uint8_t y1 = y + height - 1;
+
+  for (uint8_t bx = x >> 3; bx <= (x1 >> 3); bx++) {
+
+    uint8_t mask = 0xFF;
+
+    if (bx == (x >> 3))
+      mask &= 0xFF >> (x & 7); // Leave the pixels left of x
+
+    if (bx == (x1 >> 3))
+      mask &= (uint8_t)(0xFF << (7 - (x1 & 7))); // Leave the pixels right of x1
+
+    // One run of auto-incremented writes per pattern
+    for (uint8_t y0 = y;; y0++) {
+
+      uint8_t end = y0 | 7;
+
+      if (end > y1)
+        end = y1;
+
+      hiresSpan(bx, y0, end, mask, color1, color2);
+
+      if (end == y1)
+        break;
+
+      y0 = end;
+    }
+  }
+}
+
+void vdp_hline_hires(uint8_t x, uint8_t y, uint8_t width, uint8_t color1, uint8_t color2) {
+
+  vdp_fill_rect_hires(x, y, width, 1, color1, color2);
+}
+
+void vdp_vline_hires(uint8_t x, uint8_t y, uint8_t height, uint8_t color1, uint8_t color2) {
+
+  vdp_fill_rect_hires(x, y, 1, height, color1, color2);
+}
+#endif
+
+// Draws a straight piece of a line, len pixels from (x, y) along its major axis.
+// hires draws with the pixels of vdp_plot_hires() in color1 and color2, otherwise with those of vdp_plot_color() in color1
+void lineRun(uint8_t x, uint8_t y, uint8_t len, bool steep, int8_t step, bool hires, uint8_t color1, uint8_t color2) {
+
+  uint8_t width = len, height = 1;
+
+  if (steep) {
+
+    if (step < 0)
+      y -= len - 1;
+
+    width = 1;
+    height = len;
+  } else if (step < 0) {
+
+    x -= len - 1;
+  }
+
+#if VDP_MODES_USED & VDP_USE_G2
+  if (hires) {
+
+    vdp_fill_rect_hires(x, y, width, height, color1, color2);
+
+    return;
+  }
+#endif
+
+  vdp_fill_rect(x, y, width, height, color1);
+}
+
+// Bresenham, drawing each straight run in one go instead of pixel by pixel
+void drawLine(uint8_t x0, uint8_t y0, uint8_t x1, uint8_t y1, bool hires, uint8_t color1, uint8_t color2) {
+
+  uint8_t dx = (x1 > x0) ? x1 - x0 : x0 - x1;
+  uint8_t dy = (y1 > y0) ? y1 - y0 : y0 - y1;
+  int8_t sx = (x1 >= x0) ? 1 : -1;
+  int8_t sy = (y1 >= y0) ? 1 : -1;
+  bool steep = dy > dx;
+  uint8_t major = steep ? dy : dx;
+  uint8_t minor = steep ? dx : dy;
+  int16_t err = major / 2;
+  uint8_t run_x = x0, run_y = y0, len = 1;
+
+  for (uint8_t i = 0; i < major; i++) {
+
+    if (steep)
+      y0 += sy;
+    else
+      x0 += sx;
+
+    err -= minor;
+
+    if (err < 0) {
+
+      err += major;
+
+      if (steep)
+        x0 += sx;
+      else
+        y0 += sy;
+
+      lineRun(run_x, run_y, len, steep, steep ? sy : sx, hires, color1, color2);
+
+      run_x = x0;
+      run_y = y0;
+      len = 1;
+    } else {
+
+      len++;
+    }
+  }
+
+  lineRun(run_x, run_y, len, steep, steep ? sy : sx, hires, color1, color2);
+}
+
+void vdp_line(uint8_t x0, uint8_t y0, uint8_t x1, uint8_t y1, uint8_t color) {
+
+  drawLine(x0, y0, x1, y1, false, color, 0);
+}
+
+#if VDP_MODES_USED & VDP_USE_G2
+void vdp_line_hires(uint8_t x0, uint8_t y0, uint8_t x1, uint8_t y1, uint8_t color1, uint8_t color2) {
+
+  if (vdpModeIs(VDP_MODE_G2))
+    drawLine(x0, y0, x1, y1, true, color1, color2);
+}
+#endif
+
+void vdp_set_multicolor_shadow(uint8_t* buffer) {
+
+  _mc_shadow = buffer;
+
+  if (_mc_shadow != NULL && vdpModeIs(VDP_MODE_MULTICOLOR))
+    vdp_read_block(_pattern_table, _mc_shadow, VDP_MC_SHADOW_SIZE);
+}
+
+uint8_t vdp_get_color(uint8_t x, uint8_t y) {
+
+  uint16_t offset = pixelOffset(x, y);
+  uint8_t dot;
+
+  if (_mc_shadow != NULL) {
+
+    dot = _mc_shadow[offset];
+  } else {
+
+    VDP_LOCK();
+    setReadAddress(_pattern_table + offset);
+    dot = readByteFromVRAM();
+    VDP_UNLOCK();
+  }
+
+  if (x & 1) // Odd columns
+    return dot & 0x0F;
+
+  return dot >> 4;
+}
+
+int vdp_set_mc_viewport(uint8_t x, uint8_t y) {
+
+  if (!vdpModeIs(VDP_MODE_MULTICOLOR))
+    return VDP_ERROR;
+
+  VDP_LOCK();
+  mcNameTable((x >> 1) & 31, (y >> 3) % VDP_MC_ROWS);
+  VDP_UNLOCK();
+
+  return VDP_OK;
+}
+
+#if VDP_MODES_USED & VDP_USE_G2
+void vdp_set_g2_shadow(uint8_t* patterns, uint8_t* colors) {
+
+  // Both tables or neither, the plot functions only check the pattern shadow
+  if (patterns == NULL || colors == NULL)
+    patterns = colors = NULL;
+
+  _g2_shadow_pattern = patterns;
+  _g2_shadow_color = colors;
+
+  if (_g2_shadow_pattern != NULL && vdpModeIs(VDP_MODE_G2)) {
+
+    vdp_read_block(_pattern_table, _g2_shadow_pattern, VDP_G2_SHADOW_SIZE);
+    vdp_read_block(_color_table, _g2_shadow_color, VDP_G2_SHADOW_SIZE);
+  }
+}
+
+// Sets the color of the font patterns in all three thirds
+void colorFont(uint8_t fg, uint8_t bg) {
+
+  for (uint16_t third = 0; third < 0x1800; third += 0x800)
+    vdp_fill(_color_table + third + VDP_G2_FONT_SLOT * 8, (fg << 4) | bg, (256 - VDP_G2_FONT_SLOT) * 8);
+}
+
+int vdp_set_g2_text_tiles(bool enabled) {
+
+  if (!vdpModeIs(VDP_MODE_G2))
+    return VDP_ERROR;
+
+  if (enabled == _g2_text_tiles)
+    return VDP_OK;
+
+  _g2_text_tiles = enabled;
+
+  VDP_LOCK();
+
+  for (uint16_t third = 0; third < 0x1800; third += 0x800) {
+
+    uint16_t slots = _pattern_table + third + VDP_G2_FONT_SLOT * 8;
+    uint16_t names = _name_table + (third >> 3) + VDP_G2_FONT_SLOT;
+
+    if (enabled) {
+
+      vdp_write_block(slots, ASCII, (256 - VDP_G2_FONT_SLOT) * 8);
+
+      // The cells of the font slots start out as spaces
+      vdp_fill(names, VDP_G2_FONT_SLOT, 256 - VDP_G2_FONT_SLOT);
+    } else {
+
+      vdp_fill(slots, 0, (256 - VDP_G2_FONT_SLOT) * 8);
+      vdp_fill(_color_table + third + VDP_G2_FONT_SLOT * 8, 0, (256 - VDP_G2_FONT_SLOT) * 8);
+
+      // Back to one pattern per cell
+      setWriteAddress(names);
+
+      for (uint16_t i = VDP_G2_FONT_SLOT; i < 256; i++)
+        writeByteToVRAM(i);
+    }
+
+    if (_g2_shadow_pattern != NULL) {
+
+      memset(_g2_shadow_pattern + third + VDP_G2_FONT_SLOT * 8, 0, (256 - VDP_G2_FONT_SLOT) * 8);
+      memset(_g2_shadow_color + third + VDP_G2_FONT_SLOT * 8, 0, (256 - VDP_G2_FONT_SLOT) * 8);
+    }
+  }
+
+  if (enabled)
+    colorFont(_fgcolor, _bgcolor);
+
+  VDP_UNLOCK();
+
+  return VDP_OK;
+}
+#endif
+
+void vdp_set_deferred(bool deferred) {
+
+  if (!deferred)
+    vdp_flush();
+
+  _vdp_deferred = deferred;
+}
+
+// Copies count dirty patterns starting at pattern first from the shadow to VRAM
+void flushRun(uint16_t first, uint16_t count) {
+
+  uint16_t offset = first << 3;
+
+  if (vdpModeIs(VDP_MODE_MULTICOLOR)) {
+
+    vdp_write_block(_pattern_table + offset, _mc_shadow + offset, count << 3);
+  } else {
+
+    vdp_write_block(_pattern_table + offset, _g2_shadow_pattern + offset, count << 3);
+    vdp_write_block(_color_table + offset, _g2_shadow_color + offset, count << 3);
+  }
+}
+
+// Copies every pattern marked in bitmap from the shadow to VRAM
+void flushPatterns(const uint8_t* bitmap) {
+
+  uint16_t patterns;
+
+  if (vdpModeIs(VDP_MODE_MULTICOLOR) && _mc_shadow != NULL)
+    patterns = VDP_MC_SHADOW_SIZE / 8;
+  else if (vdpModeIs(VDP_MODE_G2) && _g2_shadow_pattern != NULL)
+    patterns = 768;
+  else
+    return;
+
+  uint16_t run_start = 0;
+  uint16_t run_len = 0;
+
+  for (uint16_t p = 0; p < patterns; p++) {
+
+    uint8_t dirty = bitmap[p >> 3];
+
+    // Skip 8 clean patterns at a time, only from the first pattern of a bitmap byte
+    if (dirty == 0 && run_len == 0 && (p & 7) == 0) {
+
+      p += 7;
+
+      continue;
+    }
+
+    if (dirty & (0x80 >> (p & 7))) {
+
+      if (run_len == 0)
+        run_start = p;
+
+      run_len++;
+    } else if (run_len != 0) {
+
+      flushRun(run_start, run_len);
+
+      run_len = 0;
+    }
+  }
+
+  if (run_len != 0)
+    flushRun(run_start, run_len);
+}
+
+void vdp_flush() {
+
+  flushPatterns(_dirty_patterns);
+
+  // The other page still needs these patterns, see vdp_begin_frame()
+  if (_vdp_double_buffer)
+    for (uint8_t i = 0; i < sizeof(_dirty_patterns); i++)
+      _dirty_presented[i] |= _dirty_patterns[i];
+
+  memset(_dirty_patterns, 0, sizeof(_dirty_patterns));
+}
+
+void vdp_wait_vblank() {
+
+  if (_vdp_irq_enabled) {
+
+    // The interrupt handler reads the status register, wait for it to count the frame
+    uint8_t frame = _vdp_frames;
+
+    while (frame == _vdp_frames);
+  } else {
+
+    while ((read_status_reg() & VDP_FLAG_FRAME) == 0);
+  }
+}
+
+int vdp_set_double_buffer(bool enabled) {
+
+  if (!vdpModeIs(VDP_MODE_MULTICOLOR))
+    return VDP_ERROR; // G2 pattern and color tables need 12k per page
+
+  if (enabled == _vdp_double_buffer)
+    return VDP_OK;
+
+  vdp_flush();
+
+  if (enabled) {
+
+    uint16_t back = vdp_alloc(VDP_BACK_PAGE, VDP_MC_SHADOW_SIZE, 0x800);
+
+    if (back == VDP_NO_REGION)
+      return VDP_ERROR;
+
+    _front_pattern_table = _pattern_table;
+    _pattern_table = back;
+
+    // Start the back page as a copy of the front page
+    if (_mc_shadow != NULL)
+      vdp_write_block(_pattern_table, _mc_shadow, VDP_MC_SHADOW_SIZE);
+    else
+      vdp_fill(_pattern_table, 0, VDP_MC_SHADOW_SIZE);
+  } else {
+
+    // Keep drawing on the visible page, the other one goes back to free VRAM
+    _pattern_table = _front_pattern_table;
+    _vram_layout.pattern_table = _pattern_table;
+    _vram_tables[1].addr = _pattern_table;
+    vdp_release(VDP_BACK_PAGE);
+
+    if (_mc_shadow != NULL)
+      vdp_write_block(_pattern_table, _mc_shadow, VDP_MC_SHADOW_SIZE);
+  }
+
+  memset(_dirty_presented, 0, sizeof(_dirty_presented));
+
+  _vdp_double_buffer = enabled;
+
+  return VDP_OK;
+}
+
+void vdp_begin_frame() {
+
+  if (!_vdp_double_buffer)
+    return;
+
+  // Bring the back page up to date with what was drawn on the front page
+  flushPatterns(_dirty_presented);
+
+  memset(_dirty_presented, 0, sizeof(_dirty_presented));
+}
+
+void vdp_present() {
+
+  vdp_flush();
+
+  if (!_vdp_double_buffer)
+    return;
+
+  uint16_t back = _front_pattern_table;
+  _front_pattern_table = _pattern_table;
+  _pattern_table = back;
+
+  if (_vdp_irq_enabled) {
+
+    // Let the interrupt handler switch pages, the old page is free once the queue is empty
+    while (!vdp_queue_register(4, _front_pattern_table >> 11));
+
+    while (_vdp_queue_tail != _vdp_queue_head);
+  } else {
+
+    vdp_wait_vblank();
+
+    setRegister(4, _front_pattern_table >> 11);
+  }
+}
+
+void vdp_enable_interrupt(bool enabled) {
+
+  _vdp_irq_enabled = enabled;
+
+  if (enabled)
+    setRegister(1, _vdp_registers[1] | R1_IE);
+  else
+    setRegister(1, _vdp_registers[1] & ~R1_IE);
+}
+
+uint8_t vdp_get_status() {
+
+  if (_vdp_irq_enabled)
+    return _vdp_status;
+
+  return read_status_reg();
+}
+
+uint8_t vdp_get_frame_count() {
+
+  return _vdp_frames;
+}
+
+// Number of bytes that can be added to the command queue
+uint8_t queueFree() {
+
+  return _vdp_queue_tail - _vdp_queue_head - 1;
+}
+
+bool vdp_queue_register(uint8_t reg, uint8_t value) {
+
+  if (queueFree() < 3)
+    return false;
+
+  uint8_t head = _vdp_queue_head;
+
+  _vdp_queue[head++] = VDP_CMD_REGISTER;
+  _vdp_queue[head++] = reg;
+  _vdp_queue[head++] = value;
+
+  _vdp_queue_head = head;
+
+  return true;
+}
+
+bool vdp_queue_write(uint16_t addr, const uint8_t* src, uint8_t len) {
+
+  if (len > VDP_QUEUE_MAX_WRITE || queueFree() < len + 4)
+    return false;
+
+  uint8_t head = _vdp_queue_head;
+
+  _vdp_queue[head++] = VDP_CMD_WRITE;
+  _vdp_queue[head++] = addr & 0xff;
+  _vdp_queue[head++] = addr >> 8;
+  _vdp_queue[head++] = len;
+
+  for (uint8_t i = 0; i < len; i++)
+    _vdp_queue[head++] = src[i];
+
+  _vdp_queue_head = head;
+
+  return true;
+}
+
+// Runs all queued commands, called from the interrupt handler
+void drainQueue() {
+
+  uint8_t tail = _vdp_queue_tail;
+
+  while (tail != _vdp_queue_head) {
+
+    uint8_t cmd = _vdp_queue[tail++];
+    uint16_t addr;
+    uint8_t len;
+
+    switch (cmd) {
+    case VDP_CMD_REGISTER:
+      len = _vdp_queue[tail++]; // register index
+      setRegister(len, _vdp_queue[tail++]);
+      break;
+    case VDP_CMD_WRITE:
+      addr = _vdp_queue[tail++];
+      addr |= _vdp_queue[tail++] << 8;
+      len = _vdp_queue[tail++];
+      setWriteAddress(addr);
+
+      while (len-- != 0)
+        writeByteToVRAM(_vdp_queue[tail++]);
+
+      break;
+    }
+  }
+
+  _vdp_queue_tail = tail;
+}
+
+#ifdef VDP_HAS_TEXT_BUFFER
+// Writes up to max_rows of the dirty console rows to VRAM, one auto-incremented block per run of dirty rows
+void consoleFlushRows(uint8_t max_rows) {
+
+  uint8_t cols = _crsr_max_x + 1;
+  uint8_t r = 0;
+
+  VDP_LOCK();
+
+  while (r <= _crsr_max_y && max_rows != 0) {
+
+    if (!_console_dirty[r]) {
+
+      r++;
+
+      continue;
+    }
+
+    uint8_t first = r;
+
+    while (r <= _crsr_max_y && _console_dirty[r] && max_rows != 0) {
+
+      _console_dirty[r++] = false;
+      _console_pending--;
+      max_rows--;
+    }
+
+    vdp_write_block(_name_table + first * cols, _textBuffer + first * cols, (r - first) * cols);
+  }
+
+  VDP_UNLOCK();
+}
+#endif
+
+void vdp_interrupt() {
+
+  // Reading the status register acknowledges the interrupt
+  _vdp_status = read_status_reg();
+
+  _vdp_frames++;
+
+  if (_vdp_busy == 0) {
+
+    drainQueue();
+
+#ifdef VDP_HAS_TEXT_BUFFER
+    // A few rows per frame, so that a long flush does not hold off the other interrupts
+    if (_console_pending != 0)
+      consoleFlushRows(VDP_CONSOLE_IRQ_ROWS);
+#endif
+  }
+
+  if (_vdp_frame_handler != NULL)
+    _vdp_frame_handler();
+}
+
+void vdp_set_frame_handler(void (*handler)(void)) {
+
+  _vdp_frame_handler = handler;
+}
+
+void vdp_alias_sprite_patterns(uint8_t first, uint8_t last, uint8_t pattern) {
+
+  for (uint8_t name = first;; name++) {
+
+    _sprite_alias[name] = pattern;
+
+    if (name == last)
+      break;
+  }
+}
+
+void vdp_set_sprite_pattern(uint8_t number, const uint8_t* sprite) {
+
+  if (_sprite_size_sel)
+    vdp_write_block(_sprite_pattern_table + 32 * number, sprite, 32);
+  else
+    vdp_write_block(_sprite_pattern_table + 8 * number, sprite, 8);
 }
 
-// Writes a byte to databus for vram access
-void writeByteToVRAM(unsigned char value) {
+// Stores a sprite position in the RAM copy, returns true if it changed
+bool storeSpritePosition(Sprite_attributes* sprite, uint16_t x, uint8_t y) {
 
-  z80_outp(0xA0, value);
-}
+  uint8_t ecclr, xpos;
 
-// Reads a byte from databus for vram access
-unsigned char readByteFromVRAM() {
-  return z80_inp(0xa0);
-}
+  if (x < 144) {
 
-void setRegister(unsigned char registerIndex, unsigned char value) {
-  writePort(value);
+    ecclr = sprite->ecclr | 0x80;
+    xpos = x;
+  } else {
 
-  writePort(0x80 | registerIndex);
-}
+    ecclr = sprite->ecclr & 0x7f;
+    xpos = x - 32;
+  }
 
-void setWriteAddress(unsigned int address) {
+  if (sprite->y == y && sprite->x == xpos && sprite->ecclr == ecclr)
+    return false;
 
-  z80_outp(0xA1, address & 0xff);
+  sprite->y = y;
+  sprite->x = xpos;
+  sprite->ecclr = ecclr;
 
-  z80_outp(0xa1, 0x40 | (address >> 8) & 0x3f);
+  return true;
 }
 
-void setReadAddress(unsigned int address) {
+// Remembers that a sprite has to be sent with the next vdp_sprite_commit()
+void markSpriteDirty(uint8_t index) {
 
-  z80_outp(0xA1, address & 0xff);
+  if (index < _sprite_dirty_first)
+    _sprite_dirty_first = index;
 
-  z80_outp(0xA1, (address >> 8) & 0x3f);
+  if (index > _sprite_dirty_last)
+    _sprite_dirty_last = index;
 }
 
-int vdp_init(uint8_t mode, uint8_t color, bool big_sprites, bool magnify) {
+void vdp_sprite_color(uint16_t addr, uint8_t color) {
 
-  _vdp_mode = mode;
+  Sprite_attributes* sprite = &_sprite_attributes[spriteIndex(addr)];
 
-  _sprite_size_sel = big_sprites;
+  sprite->ecclr = sprite->ecclr & 0x80 | (color & 0x0F);
 
-  // Clear Ram
-  setWriteAddress(0x0);
+  vdp_write_block(addr + 3, &sprite->ecclr, 1);
+}
 
-  for (int i = 0; i < 0x3FFF; i++)
-    writeByteToVRAM(0);
+void vdp_sprite_get_position(uint16_t addr, uint16_t* xpos, uint8_t* ypos) {
 
-  switch (mode) {
-  case VDP_MODE_G1:
+  Sprite_attributes* sprite = &_sprite_attributes[spriteIndex(addr)];
 
-    setRegister(0, 0x00);
-    setRegister(1, 0xC0 | (big_sprites << 1) | magnify); // Ram size 16k, activate video output
-    setRegister(2, 0x05); // Name table at 0x1400
-    setRegister(3, 0x80); // Color, start at 0x2000
-    setRegister(4, 0x01); // Pattern generator start at 0x800
-    setRegister(5, 0x20); // Sprite attriutes start at 0x1000
-    setRegister(6, 0x00); // Sprite pattern table at 0x000
-    _sprite_pattern_table = 0;
-    _pattern_table = 0x800;
-    _sprite_attribute_table = 0x1000;
-    _name_table = 0x1400;
-    _color_table = 0x2000;
-    _color_table_size = 32;
+  *ypos = sprite->y;
 
-    // Initialize pattern table with ASCII patterns
-    setWriteAddress(_pattern_table + 0x100);
+  if ((sprite->ecclr & 0x80) != 0)
+    *xpos = sprite->x;
+  else
+    *xpos = sprite->x + 32;
+}
 
-    for (uint16_t i = 0; i < 768; i++)
-      writeByteToVRAM(ASCII[i]);
+uint16_t vdp_sprite_init(uint8_t name, uint8_t priority, uint8_t color) {
 
-    break;
+  uint16_t addr = _sprite_attribute_table + 4 * priority;
+  Sprite_attributes* sprite = &_sprite_attributes[priority];
 
-  case VDP_MODE_G2:
+  sprite->y = 0;
+  sprite->x = 0;
 
-    setRegister(0, 0x02);
-    setRegister(1, 0xC0 | (big_sprites << 1) | magnify); // Ram size 16k, Disable Int, 16x16 Sprites, mag off, activate video output
-    setRegister(2, 0x0E); // Name table at 0x3800
-    setRegister(3, 0xFF); // Color, start at 0x2000
-    setRegister(4, 0x03); // Pattern generator start at 0x0
-    setRegister(5, 0x76); // Sprite attriutes start at 0x3800
-    setRegister(6, 0x03); // Sprite pattern table at 0x1800
-    _pattern_table = 0x00;
-    _sprite_pattern_table = 0x1800;
-    _color_table = 0x2000;
-    _name_table = 0x3800;
-    _sprite_attribute_table = 0x3B00;
-    _color_table_size = 0x1800;
-    setWriteAddress(_name_table);
+  sprite->name_ptr = spritePattern(name);
 
-    for (uint16_t i = 0; i < 768; i++)
-      writeByteToVRAM(i);
+  sprite->ecclr = 0x80 | (color & 0xF);
 
-    break;
+  vdp_write_block(addr, (uint8_t*)sprite, 4);
 
-  case VDP_MODE_TEXT:
+  return addr;
+}
 
-    setRegister(0, 0x00);
-    setRegister(1, 0xD2); // Ram size 16k, Disable Int
-    setRegister(2, 0x02); // Name table at 0x800
-    setRegister(4, 0x00); // Pattern table start at 0x0
-    _pattern_table = 0x00;
-    _name_table = 0x800;
-    _crsr_max_x = 39;
-    setWriteAddress(_pattern_table + 0x100);
+uint8_t vdp_sprite_set_position(uint16_t addr, uint16_t x, uint8_t y) {
 
-    for (uint16_t i = 0; i < 23 * 40; i++)
-      _textBuffer[i] = 0x20;
+  Sprite_attributes* sprite = &_sprite_attributes[spriteIndex(addr)];
 
-    for (uint16_t i = 0; i < 768; i++)
-      writeByteToVRAM(ASCII[i]);
+  if (storeSpritePosition(sprite, x, y))
+    vdp_write_block(addr, (uint8_t*)sprite, 4);
 
-    vdp_set_cursor2(0, 0);
+  return vdp_get_status();
+}
 
-    break;
+void vdp_sprite_move(uint16_t addr, uint16_t x, uint8_t y) {
 
-  case VDP_MODE_MULTICOLOR:
+  uint8_t index = spriteIndex(addr);
 
-    setRegister(0, 0x00);
-    setRegister(1, 0xC8 | (big_sprites << 1) | magnify); // Ram size 16k, Multicolor
-    setRegister(2, 0x05); // Name table at 0x1400
-    // setRegister(3, 0xFF); // Color table not available
-    setRegister(4, 0x01); // Pattern table start at 0x800
-    setRegister(5, 0x76); // Sprite Attribute table at 0x3b00
-    setRegister(6, 0x03); // Sprites Pattern Table at 0x1800
-    _pattern_table = 0x800;
-    _sprite_attribute_table = 0x3b00;
-    _sprite_pattern_table = 0x1800;
-    _name_table = 0x1400;
-    setWriteAddress(_name_table); // Init name table
-
-    for (uint8_t j = 0; j < 24; j++)
-      for (uint16_t i = 0; i < 32; i++)
-        writeByteToVRAM(i + 32 * (j / 4));
+  if (storeSpritePosition(&_sprite_attributes[index], x, y))
+    markSpriteDirty(index);
+}
 
-    break;
-  default:
-    return VDP_ERROR; // Unsupported mode
-  }
+void vdp_sprite_set_color(uint16_t addr, uint8_t color) {
 
-  setRegister(7, color);
+  uint8_t index = spriteIndex(addr);
+  Sprite_attributes* sprite = &_sprite_attributes[index];
 
-  return VDP_OK;
+  sprite->ecclr = sprite->ecclr & 0x80 | (color & 0x0F);
+
+  markSpriteDirty(index);
 }
 
-void vdp_dumpFontToScreen() {
+void vdp_sprite_set_name(uint16_t addr, uint8_t name) {
 
-  for (uint8_t j = 0; j < 24; j++)
-    for (uint16_t i = 0; i < 32; i++)
-      writeByteToVRAM(i + 32 * (j / 4));
+  uint8_t index = spriteIndex(addr);
+
+  _sprite_attributes[index].name_ptr = spritePattern(name);
+
+  markSpriteDirty(index);
 }
 
-void vdp_colorize(uint8_t fg, uint8_t bg) {
+void vdp_sprite_commit() {
 
-  if (_vdp_mode != VDP_MODE_G2)
+  if (_sprite_dirty_first > _sprite_dirty_last)
     return;
 
-  uint16_t name_offset = cursor.y * (_crsr_max_x + 1) + cursor.x; // Position in name table
-  uint16_t color_offset = name_offset << 3;                       // Offset of pattern in pattern table
-  setWriteAddress(_color_table + color_offset);
+  uint8_t offset = _sprite_dirty_first << 2;
+  uint8_t len = (_sprite_dirty_last - _sprite_dirty_first + 1) << 2;
+  const uint8_t* src = (const uint8_t*)_sprite_attributes + offset;
 
-  for (uint8_t i = 0; i < 8; i++)
-    writeByteToVRAM((fg << 4) + bg);
+  _sprite_dirty_first = 0xff;
+  _sprite_dirty_last = 0;
+
+  // Queued writes run in order, so once the interrupt is on every commit goes through the queue
+  if (_vdp_irq_enabled)
+    while (!vdp_queue_write(_sprite_attribute_table + offset, src, len));
+  else
+    vdp_write_block(_sprite_attribute_table + offset, src, len);
 }
 
-void vdp_plot_hires(uint8_t x, uint8_t y, uint8_t color1, uint8_t color2) {
+uint8_t vdp_object_add(uint8_t name, uint8_t color) {
 
-  uint16_t offset = 8 * (x / 8) + y % 8 + 256 * (y / 8);
-  setReadAddress(_pattern_table + offset);
-  uint8_t pixel = readByteFromVRAM();
-  setReadAddress(_color_table + offset);
-  uint8_t color = readByteFromVRAM();
+  for (uint8_t id = 0; id < VDP_MAX_OBJECTS; id++) {
 
-  if (color1 != NULL) {
+    Sprite_object* object = &_objects[id];
 
-    pixel |= 0x80 >> (x % 8); //Set a "1"
-    color = (color & 0x0F) | (color1 << 4);
-  } else {
+    if (object->active)
+      continue;
 
-    pixel &= ~(0x80 >> (x % 8)); //Set bit as "0"
-    color = (color & 0xF0) | (color2 & 0x0F);
-  }
+    object->x = 0;
+    object->y = 192; // Below the screen until moved
+    object->name = name;
+    object->color = color;
+    object->active = true;
 
-  setWriteAddress(_pattern_table + offset);
-  writeByteToVRAM(pixel);
-  setWriteAddress(_color_table + offset);
-  writeByteToVRAM(color);
-}
+    _object_order[_object_count++] = id;
 
-void vdp_plot_color(uint8_t x, uint8_t y, uint8_t color) {
+    return id;
+  }
 
-  if (_vdp_mode == VDP_MODE_MULTICOLOR) {
+  return VDP_NO_OBJECT;
+}
 
-    uint16_t addr = _pattern_table + 8 * (x / 2) + y % 8 + 256 * (y / 8);
-    setReadAddress(addr);
-    uint8_t dot = readByteFromVRAM();
-    setWriteAddress(addr);
+void vdp_object_remove(uint8_t id) {
 
-    if (x & 1) // Odd columns
-      writeByteToVRAM((dot & 0xF0) + (color & 0x0f));
-    else
-      writeByteToVRAM((dot & 0x0F) + (color << 4));
-  } else if (_vdp_mode == VDP_MODE_G2) {
+  if (!_objects[id].active)
+    return;
 
-    // Draw bitmap
-    uint16_t offset = 8 * (x / 2) + y % 8 + 256 * (y / 8);
-    setReadAddress(_color_table + offset);
-    uint8_t color_ = readByteFromVRAM();
+  _objects[id].active = false;
 
-    if ((x & 1) == 0) //Even 
-    {
+  uint8_t i = 0;
 
-      color_ &= 0x0F;
-      color_ |= (color << 4);
-    } else {
+  while (_object_order[i] != id)
+    i++;
 
-      color_ &= 0xF0;
-      color_ |= color & 0x0F;
-    }
+  _object_count--;
 
-    setWriteAddress(_pattern_table + offset);
-    writeByteToVRAM(0xF0);
-    setWriteAddress(_color_table + offset);
-    writeByteToVRAM(color_);
-    // Colorize
-  }
+  for (; i < _object_count; i++)
+    _object_order[i] = _object_order[i + 1];
 }
 
-void vdp_set_sprite_pattern(uint8_t number, const uint8_t* sprite) {
+void vdp_object_move(uint8_t id, uint16_t x, uint8_t y) {
 
-  if (_sprite_size_sel) {
+  _objects[id].x = x;
 
-    setWriteAddress(_sprite_pattern_table + 32 * number);
+  // 0xD0 would end the sprite attribute table
+  _objects[id].y = (y == 0xD0) ? 0xD1 : y;
+}
 
-    for (uint8_t i = 0; i < 32; i++) {
-      writeByteToVRAM(sprite[i]);
-    }
-  } else {
+void vdp_object_set_color(uint8_t id, uint8_t color) {
 
-    setWriteAddress(_sprite_pattern_table + 8 * number);
+  _objects[id].color = color;
+}
 
-    for (uint8_t i = 0; i < 8; i++) {
-      writeByteToVRAM(sprite[i]);
-    }
-  }
+void vdp_object_set_name(uint8_t id, uint8_t name) {
 
+  _objects[id].name = name;
 }
 
-void vdp_sprite_color(uint16_t addr, uint8_t color) {
+void vdp_objects_update() {
 
-  setReadAddress(addr + 3);
+  uint8_t count = _object_count;
 
-  uint8_t ecclr = readByteFromVRAM() & 0x80 | (color & 0x0F);
+  // Insertion sort, the order of the last frame is usually almost right
+  for (uint8_t i = 1; i < count; i++) {
 
-  setWriteAddress(addr + 3);
+    uint8_t id = _object_order[i];
+    uint8_t y = _objects[id].y;
+    uint8_t j = i;
 
-  writeByteToVRAM(ecclr);
-}
+    for (; j > 0 && _objects[_object_order[j - 1]].y > y; j--)
+      _object_order[j] = _object_order[j - 1];
 
-//Sprite_attributes vdp_sprite_get_attributes(uint16_t addr) {
-//
-//  Sprite_attributes attrs;
-//
-//  setReadAddress(addr);
-//
-//  attrs.y = readByteFromVRAM();
-//  attrs.x = readByteFromVRAM();
-//  attrs.name_ptr = readByteFromVRAM();
-//  attrs.ecclr = readByteFromVRAM();
-//
-//  return attrs;
-//}
+    _object_order[j] = id;
+  }
 
-void vdp_sprite_get_position(uint16_t addr, uint16_t xpos, uint8_t ypos) {
+  uint8_t slots = (count < 32) ? count : 32;
 
-  setReadAddress(addr);
+  if (count != 0) {
 
-  ypos = readByteFromVRAM();
+    uint8_t status = vdp_get_status();
 
-  uint8_t x = readByteFromVRAM();
+    // The sprite dropped on a crowded line gets the highest priority next frame,
+    // with more objects than sprites the ones left out last frame are shown instead
+    if (status & VDP_FLAG_S5)
+      _object_rotation += status & 0x1F;
+    else if (count > 32)
+      _object_rotation += 32;
 
-  readByteFromVRAM();
+    while (_object_rotation >= count)
+      _object_rotation -= count;
+  }
 
-  uint8_t eccr = readByteFromVRAM();
+  uint8_t next = _object_rotation;
 
-  if ((eccr & 0x80) != 0)
-    xpos = x;
-  else
-    xpos = x + 32;
-}
+  for (uint8_t slot = 0; slot < slots; slot++) {
 
-uint16_t vdp_sprite_init(uint8_t name, uint8_t priority, uint8_t color) {
+    Sprite_object* object = &_objects[_object_order[next]];
+    Sprite_attributes* sprite = &_sprite_attributes[slot];
 
-  uint16_t addr = _sprite_attribute_table + 4 * priority;
-  setWriteAddress(addr);
-  writeByteToVRAM(0);
-  writeByteToVRAM(0);
+    sprite->y = object->y;
 
-  if (_sprite_size_sel)
-    writeByteToVRAM(4 * name);
-  else
-    writeByteToVRAM(name);
+    if (object->x < 144) {
 
-  writeByteToVRAM(0x80 | (color & 0xF));
+      sprite->x = object->x;
+      sprite->ecclr = 0x80 | (object->color & 0x0F);
+    } else {
 
-  return addr;
-}
+      sprite->x = object->x - 32;
+      sprite->ecclr = object->color & 0x0F;
+    }
 
-uint8_t vdp_sprite_set_position(uint16_t addr, uint16_t x, uint8_t y) {
+    sprite->name_ptr = spritePattern(object->name);
 
-  uint8_t ec, xpos;
+    if (++next == count)
+      next = 0;
+  }
 
-  if (x < 144) {
+  // Hide the remaining sprites
+  if (slots < 32)
+    _sprite_attributes[slots].y = 0xD0;
 
-    ec = 1;
-    xpos = x;
-  } else {
+  markSpriteDirty(0);
+  markSpriteDirty((slots < 32) ? slots : 31);
 
-    ec = 0;
-    xpos = x - 32;
-  }
+  vdp_sprite_commit();
+}
 
-  setReadAddress(addr + 3);
-  uint8_t color = readByteFromVRAM() & 0x0f;
+bool vdp_queue_sprite_position(uint16_t addr, uint16_t x, uint8_t y) {
 
-  setWriteAddress(addr);
-  writeByteToVRAM(y);
-  writeByteToVRAM(xpos);
-  setWriteAddress(addr + 3);
-  writeByteToVRAM((ec << 7) | color);
+  if (queueFree() < 8)
+    return false;
 
-  return read_status_reg();
+  Sprite_attributes* sprite = &_sprite_attributes[spriteIndex(addr)];
+
+  storeSpritePosition(sprite, x, y);
+
+  return vdp_queue_write(addr, (uint8_t*)sprite, 4);
 }
 
 void vdp_print(uint8_t* text) {
@@ -421,12 +2476,14 @@ void vdp_set_bdcolor(uint8_t color) {
 
 void vdp_set_pattern_color(uint16_t index, uint8_t fg, uint8_t bg) {
 
-  if (_vdp_mode == VDP_MODE_G1) {
+  if (vdpModeIs(VDP_MODE_G1)) {
     index &= 31;
   }
 
+  VDP_LOCK();
   setWriteAddress(_color_table + index);
   writeByteToVRAM((fg << 4) + bg);
+  VDP_UNLOCK();
 }
 
 void vdp_set_cursor2(uint8_t col, uint8_t row) {
@@ -474,8 +2531,17 @@ void vdp_textcolor(uint8_t fg, uint8_t bg) {
 
   _bgcolor = bg;
 
-  if (_vdp_mode == VDP_MODE_TEXT)
+  if (vdpModeIs(VDP_MODE_TEXT))
     setRegister(7, (fg << 4) + bg);
+
+  // Each color table entry colors 8 characters, all of them are changed like in text mode
+  if (vdpModeIs(VDP_MODE_G1))
+    vdp_fill(_color_table, (fg << 4) + bg, 32);
+
+#if VDP_MODES_USED & VDP_USE_G2
+  if (_g2_text_tiles)
+    colorFont(fg, bg);
+#endif
 }
 
 void vdp_write(uint8_t chr, bool advanceNextChar) {
@@ -485,21 +2551,34 @@ void vdp_write(uint8_t chr, bool advanceNextChar) {
     uint16_t name_offset = cursor.y * (_crsr_max_x + 1) + cursor.x; // Position in name table
     uint16_t pattern_offset = name_offset << 3;                    // Offset of pattern in pattern table
 
-    if (_vdp_mode == VDP_MODE_G2) {
+    if (vdpModeIs(VDP_MODE_G2)) {
+
+#if VDP_MODES_USED & VDP_USE_G2
+      if (_g2_text_tiles) {
 
-      setWriteAddress(_pattern_table + pattern_offset);
+        VDP_LOCK();
+        setWriteAddress(_name_table + name_offset);
 
-      for (uint8_t i = 0; i < 8; i++)
-        writeByteToVRAM(ASCII[((chr - 32) << 3) + i]);
+        writeByteToVRAM(chr - 32 + VDP_G2_FONT_SLOT);
+        VDP_UNLOCK();
+      } else {
+
+        vdp_write_block(_pattern_table + pattern_offset, ASCII + ((chr - 32) << 3), 8);
+      }
+#endif
 
     } else {
 
+#ifdef VDP_HAS_TEXT_BUFFER
       // G1 and text mode
+      VDP_LOCK();
       setWriteAddress(_name_table + name_offset);
 
       writeByteToVRAM(chr);
+      VDP_UNLOCK();
 
       _textBuffer[cursor.y * (_crsr_max_x + 1) + cursor.x] = chr;
+#endif
     }
 
     if (advanceNextChar)
@@ -507,26 +2586,35 @@ void vdp_write(uint8_t chr, bool advanceNextChar) {
   }
 }
 
+#ifdef VDP_HAS_TEXT_BUFFER
 void vdp_writeCharAtLocation(uint8_t x, uint8_t y, uint8_t c) {
 
   uint16_t name_offset = y * (_crsr_max_x + 1) + x; // Position in name table
 
   _textBuffer[y * (_crsr_max_x + 1) + x] = c;
 
+  VDP_LOCK();
   setWriteAddress(_name_table + name_offset);
 
   writeByteToVRAM(c);
+  VDP_UNLOCK();
 }
+#endif
 
 uint8_t vdp_getCharAtLocationVRAM(uint8_t x, uint8_t y) {
 
   uint16_t name_offset = y * (_crsr_max_x + 1) + x; // Position in name table
 
+  VDP_LOCK();
   setReadAddress(_name_table + name_offset);
 
-  return readByteFromVRAM();
+  uint8_t c = readByteFromVRAM();
+  VDP_UNLOCK();
+
+  return c;
 }
 
+#ifdef VDP_HAS_TEXT_BUFFER
 uint8_t vdp_getCharAtLocationBuf(uint8_t x, uint8_t y) {
   return _textBuffer[y * (_crsr_max_x + 1) + x];
 }
@@ -537,47 +2625,251 @@ void vdp_setCharAtLocationBuf(uint8_t x, uint8_t y, uint8_t c) {
 
 void vdp_ScrollTextUp(uint8_t topRow, uint8_t bottomRow) {
 
+  uint8_t cols = _crsr_max_x + 1;
+  uint16_t name_offset = topRow * cols;
+  uint16_t len = (bottomRow - topRow) * cols;
+
+  memmove(_textBuffer + name_offset, _textBuffer + name_offset + cols, len);
+
+  if (bottomRow < _crsr_max_y) {
+
+    memset(_textBuffer + name_offset + len, 0x20, cols);
+
+    len += cols;
+  }
+
+  vdp_write_block(_name_table + name_offset, _textBuffer + name_offset, len);
+}
+
+void vdp_ClearRows(uint8_t topRow, uint8_t bottomRow) {
+
   uint16_t name_offset = topRow * (_crsr_max_x + 1);
+  uint16_t len = (bottomRow - topRow) * (_crsr_max_x + 1);
 
-  setWriteAddress(_name_table + name_offset);
+  memset(_textBuffer + name_offset, 0x20, len);
+
+  vdp_fill(_name_table + name_offset, 0x20, len);
+}
+
+// Marks a console row for the next flush
+void consoleDirty(uint8_t r) {
+
+  if (!_console_dirty[r]) {
+
+    _console_dirty[r] = true;
+    _console_pending++;
+  }
+}
+
+// Moves the console up one row. A row only becomes dirty if the row moved into it differs
+void consoleScroll() {
+
+  uint8_t cols = _crsr_max_x + 1;
+  uint8_t* row = _textBuffer;
+
+  for (uint8_t r = 0; r < _crsr_max_y; r++, row += cols)
+    if (!_console_dirty[r] && memcmp(row, row + cols, cols) != 0)
+      consoleDirty(r);
+
+  memmove(_textBuffer, _textBuffer + cols, _crsr_max_y * cols);
 
-  for (uint8_t y = topRow; y < bottomRow; y++)
-    for (uint8_t x = 0; x < 40; x++) {
+  for (uint8_t i = 0; i < cols; i++) {
 
-      _textBuffer[name_offset] = _textBuffer[name_offset + _crsr_max_x + 1];
+    if (row[i] != 0x20) {
 
-      writeByteToVRAM(_textBuffer[name_offset]);
+      memset(row, 0x20, cols);
 
-      name_offset++;
+      consoleDirty(_crsr_max_y);
+
+      break;
     }
+  }
+}
+
+void consoleNewLine() {
+
+  if (cursor.y == _crsr_max_y) {
+
+    consoleScroll();
+  } else {
+
+    cursor.y++;
+    _console_row += _crsr_max_x + 1;
+  }
+}
+
+// Handles a byte of an ESC [ sequence: m sets colors, J clears the screen, H moves the cursor
+void consoleEscape(uint8_t c) {
+
+  if (_console_escape == 1) {
+
+    _console_escape = (c == '[') ? 2 : 0;
+    _console_param = 0;
+    memset(_console_params, 0, sizeof(_console_params));
+
+    return;
+  }
+
+  if (c >= '0' && c <= '9') {
+
+    _console_params[_console_param] = _console_params[_console_param] * 10 + c - '0';
+
+    return;
+  }
+
+  if (c == ';') {
+
+    if (_console_param < sizeof(_console_params) - 1)
+      _console_param++;
+
+    return;
+  }
+
+  _console_escape = 0;
+
+  switch (c) {
+
+  case 'm':
+
+    for (uint8_t i = 0; i <= _console_param; i++) {
+
+      uint8_t param = _console_params[i];
 
-  if (bottomRow < _crsr_max_y)
-    for (uint8_t x = 0; x < 40; x++) {
+      if (param == 0) {
 
-      _textBuffer[name_offset] = 0x20;
+        _fgcolor = VDP_BLACK;
+        _bgcolor = VDP_WHITE;
+      } else if (param >= 30 && param <= 37) {
 
-      writeByteToVRAM(0x20);
+        _fgcolor = _ansi_colors[param - 30];
+      } else if (param >= 90 && param <= 97) {
 
-      name_offset++;
+        _fgcolor = _ansi_colors[param - 90 + 8];
+      } else if (param >= 40 && param <= 47) {
+
+        _bgcolor = _ansi_colors[param - 40];
+      } else if (param >= 100 && param <= 107) {
+
+        _bgcolor = _ansi_colors[param - 100 + 8];
+      }
     }
+
+    vdp_textcolor(_fgcolor, _bgcolor);
+
+    break;
+
+  case 'J':
+
+    if (_console_params[0] == 2)
+      vdp_console_clear();
+
+    break;
+
+  case 'H':
+
+    // Rows and columns count from 1
+    cursor.y = _console_params[0] ? _console_params[0] - 1 : 0;
+    cursor.x = _console_params[1] ? _console_params[1] - 1 : 0;
+
+    if (cursor.y > _crsr_max_y)
+      cursor.y = _crsr_max_y;
+
+    if (cursor.x > _crsr_max_x)
+      cursor.x = _crsr_max_x;
+
+    _console_row = _textBuffer + cursor.y * (_crsr_max_x + 1);
+
+    break;
+  }
 }
 
-void vdp_ClearRows(uint8_t topRow, uint8_t bottomRow) {
+void vdp_console_write(const uint8_t* text, uint16_t len) {
 
-  uint16_t name_offset = topRow * (_crsr_max_x + 1);
+  // Keeps the frame interrupt from flushing rows while they are being changed
+  VDP_LOCK();
 
-  setWriteAddress(_name_table + name_offset);
+  _console_row = _textBuffer + cursor.y * (_crsr_max_x + 1);
+
+  for (; len != 0; len--) {
+
+    // Every row is waiting, batching more can not save a write
+    if (_console_pending > _crsr_max_y)
+      vdp_console_flush();
+
+    uint8_t c = *text++;
+
+    if (_console_escape) {
+
+      consoleEscape(c);
+
+      continue;
+    }
+
+    switch (c) {
+
+    case 0x1B:
+      _console_escape = 1;
+      continue;
+    case '\r':
+      cursor.x = 0;
+      continue;
+    case '\n':
+      consoleNewLine();
+      continue;
+    case '\b':
+      if (cursor.x != 0)
+        cursor.x--;
+      continue;
+    }
 
-  for (uint8_t y = topRow; y < bottomRow; y++)
-    for (uint8_t x = 0; x < 40; x++) {
+    if (c < 0x20)
+      continue;
 
-      _textBuffer[name_offset] = 0x20;
+    // Wrap when the next character arrives, so that a full line followed by a new line does not scroll twice
+    if (cursor.x > _crsr_max_x) {
 
-      writeByteToVRAM(0x20);
+      cursor.x = 0;
+      consoleNewLine();
+    }
+
+    uint8_t* cell = _console_row + cursor.x++;
 
-      name_offset++;
+    if (*cell != c) {
+
+      *cell = c;
+      consoleDirty(cursor.y);
     }
+  }
+
+  // Once per frame when the frame interrupt is counting frames, in case it found the console busy
+  if ((_vdp_irq_enabled && _console_frame != _vdp_frames) || _console_pending > _crsr_max_y)
+    vdp_console_flush();
+
+  VDP_UNLOCK();
+}
+
+void vdp_console_flush() {
+
+  _console_frame = _vdp_frames;
+
+  consoleFlushRows(_crsr_max_y + 1);
+}
+
+void vdp_console_clear() {
+
+  VDP_LOCK();
+
+  memset(_textBuffer, 0x20, (_crsr_max_y + 1) * (_crsr_max_x + 1));
+  memset(_console_dirty, true, sizeof(_console_dirty));
+  _console_pending = _crsr_max_y + 1;
+
+  cursor.x = 0;
+  cursor.y = 0;
+  _console_row = _textBuffer;
+
+  VDP_UNLOCK();
 }
+#endif
 
 void vdp_writeUInt8(uint8_t v) {
 
@@ -20,6 +20,7 @@ void main2();
 void main() { main2(); }
 
 #define FONT_STANDARD
+#define VDP_MODES_USED VDP_USE_MULTICOLOR
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,6 +29,7 @@ void main() { main2(); }
 
 #include "nabu.h"
 #include "tms9918.h"
+#include "sched.h"
 
 #define MAX_ITERATION 50
 
@@ -67,6 +69,8 @@ float cr_max = 2;
 float ci_min = -2;
 float ci_max = 2;
 
+uint8_t mc_shadow[VDP_MC_SHADOW_SIZE];
+
 void centerCursor(void) {
     cursor_xpos = 160 - 8;
     cursor_ypos = 96 - 6;
@@ -85,7 +89,8 @@ int iterationCount(float cr, float ci, bool (*callback_func)(void)) {
     bool keepgoing = true;
 
     while (keepgoing && (zr * zr + zi * zi < 4) && (i < MAX_ITERATION)) {
-        if (callback_func != NULL) {
+        // One memory load per iteration, the keyboard interrupt queues the keys
+        if (callback_func != NULL && KeyPending) {
             keepgoing = callback_func();
         }
         temp = zr * zr - zi * zi + cr;
@@ -192,11 +197,23 @@ void main2() {
     float new_ci_min = ci_min;
     float new_ci_max = ci_max;
 
+    nabu_enable_key_buffer(true);
+
+    vdp_set_multicolor_shadow(mc_shadow);
+
+    vdp_init(VDP_MODE_MULTICOLOR, VDP_DARK_BLUE, SPRITE_LARGE, false);
+    vdp_set_sprite_pattern(0, cursor_sprite_large);
+    vdp_alias_sprite_patterns(0, 255, 0);
+
+    // Frame ticks for task_sleep()
+    vdp_set_frame_handler(sched_tick);
+    nabu_set_interrupt_handler(INT_VDP, vdp_interrupt);
+    vdp_enable_interrupt(true);
+
     while (true) {
-        vdp_init(VDP_MODE_MULTICOLOR, VDP_DARK_BLUE, SPRITE_LARGE, false);
-        for (int i = 0; i < 256; i++) {
-            vdp_set_sprite_pattern(i, cursor_sprite_large);
-        }
+        // Only the picture and the sprite need to start over for each zoom
+        vdp_reconfigure(VDP_MODE_MULTICOLOR, VDP_DARK_BLUE, SPRITE_LARGE, false,
+                        VDP_TABLE_PATTERN | VDP_TABLE_SPRITE_ATTRIBUTES);
 
         sprite_handle = vdp_sprite_init(0, 0, VDP_WHITE);
         vdp_sprite_set_position(sprite_handle, cursor_xpos, cursor_ypos);
@@ -219,7 +236,7 @@ void main2() {
         }
         while (keepgoing) {
             keepgoing = handle_input();
-            z80_delay_ms(100);
+            task_sleep(6);
         }
 
         new_cr_min = sprite_x_to_cr(cursor_xpos - 32, cr_min, cr_max);
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <z80.h> // https://github.com/z88dk/z88dk/blob/master/include/_DEVELOPMENT/sdcc/z80.h
+#include "tms9918.h" // hcca_stream_to_vram() writes VRAM
 
 inline void nop() {
   __asm
@@ -18,14 +19,289 @@ inline void nop() {
     __endasm;
 }
 
+uint8_t _interruptMask = 0;              // Last value written to the interrupt mask register
+void (*_interruptHandlers[4])(void);      // Handlers by interrupt source
+uint8_t _vectorPage = INT_VECTOR_TABLE >> 8;
+bool _interruptsInitialized = false;
+
+// HCCA receive ring buffer, see hcca_enable_rx_buffer(). The interrupt routine only writes the head,
+// the main program only the tail, one slot stays free to tell a full buffer from an empty one.
+uint8_t _hccaRxBuffer[HCCA_RX_BUFFER_SIZE];
+volatile uint8_t _hccaRxHead = 0;
+volatile uint8_t _hccaRxTail = 0;
+volatile bool _hccaRxOverflow = false;   // Set by the interrupt routine when it drops a byte
+bool _hccaRxBuffered = false;
+
+// HCCA transmit queue, see hcca_enable_tx_queue(). The main program only writes the head, the
+// interrupt routine only the tail.
+uint8_t _hccaTxBuffer[HCCA_TX_BUFFER_SIZE];
+volatile uint8_t _hccaTxHead = 0;
+volatile uint8_t _hccaTxTail = 0;
+bool _hccaTxQueued = false;
+
+// Keyboard buffer, see nabu_enable_key_buffer(). The interrupt handler only writes the head and
+// sets KeyPending, the main program only writes the tail and clears KeyPending.
+uint8_t _keyBuffer[KEY_BUFFER_SIZE];
+volatile uint8_t _keyHead = 0;
+volatile uint8_t _keyTail = 0;
+volatile uint8_t KeyPending = 0;
+bool _keyBuffered = false;
+
+// Sound engine state of each AY channel, see sound_play()
+typedef struct {
+  const uint8_t* start;  // Beginning of the sequence, for SND_LOOP
+  const uint8_t* pos;    // Next command, NULL while the channel is silent
+  uint16_t period;       // Tone period of the current note
+  int8_t slide;          // Added to the period every frame
+  uint8_t frames;        // Frames left of the current note or rest
+  uint8_t volume;        // Volume the notes start at
+  uint8_t level;         // Current volume, 0 during a rest
+  uint8_t decay;         // Frames per volume step down, 0 to hold
+  uint8_t decay_count;
+  uint8_t mix;           // SND_TONE, SND_NOISE or SND_TONE_NOISE
+} Sound_channel;
+
+Sound_channel _soundChannels[3];
+uint8_t _soundNoise = 0;
+uint8_t _ayRegisters[11];        // Last values the sound engine wrote to AY registers 0-10
+bool _soundStarted = false;
+
+// Overlay regions, see overlay_define()
+typedef struct {
+  uint8_t* addr;
+  uint16_t size;
+  uint32_t segment;      // Segment loaded into the region, NABU_NO_SEGMENT if none
+} Overlay_region;
+
+Overlay_region _overlays[OVERLAY_MAX];
+
 void ayWrite(uint8_t reg, uint8_t val) {
 
-  z80_outp(AYLATCH, reg);
-  z80_outp(AYDATA, val);
+  // Interrupt handlers may also select AY registers
+  __critical {
+    z80_outp(AYLATCH, reg);
+    z80_outp(AYDATA, val);
+  }
+}
+
+void setInterruptMask(uint8_t mask) {
+
+  _interruptMask = mask;
+
+  ayWrite(IOPORTA, mask);
+}
+
+// Calls the handler of an interrupt source, or masks the source if there is none
+void runInterruptHandler(uint8_t source, uint8_t mask) {
+
+  if (_interruptHandlers[source] != NULL)
+    _interruptHandlers[source]();
+  else
+    setInterruptMask(_interruptMask & ~mask);
+}
+
+void isrHccaRx(void) __critical __interrupt(0) {
+
+  runInterruptHandler(INT_HCCARX, INT_MASK_HCCARX);
+}
+
+void isrHccaTx(void) __critical __interrupt(0) {
+
+  runInterruptHandler(INT_HCCATX, INT_MASK_HCCATX);
+}
+
+void isrKeyboard(void) __critical __interrupt(0) {
+
+  runInterruptHandler(INT_KEYBOARD, INT_MASK_KEYBOARD);
+}
+
+void isrVdp(void) __critical __interrupt(0) {
+
+  runInterruptHandler(INT_VDP, INT_MASK_VDP);
+}
+
+// Receive interrupt routine of the ring buffer, stores the byte at the head unless the buffer is full,
+// in which case it flags the overflow. Reading the byte acknowledges the interrupt. 202 T-states
+void hccaRxIsr(void) __naked {
+
+  __asm
+    push af
+    push bc
+    push hl
+    in a, (0x80)
+    ld c, a
+    ld a, (__hccaRxHead)
+    ld b, a
+    inc a
+    and HCCA_RX_BUFFER_SIZE - 1
+    ld hl, __hccaRxTail
+    cp (hl)
+    jr z, hccaRxIsr_full
+    ld (__hccaRxHead), a
+    ld hl, __hccaRxBuffer
+    ld a, l
+    add a, b
+    ld l, a
+    jr nc, hccaRxIsr_store
+    inc h
+  hccaRxIsr_store:
+    ld (hl), c
+  hccaRxIsr_done:
+    pop hl
+    pop bc
+    pop af
+    ei
+    reti
+  hccaRxIsr_full:
+    ld a, 1
+    ld (__hccaRxOverflow), a
+    jr hccaRxIsr_done
+  __endasm;
+}
+
+// Transmit interrupt routine of the queue, sends the byte at the tail. When the queue is empty it masks
+// the transmit interrupt instead (0xBF clears INT_MASK_HCCATX), hcca_send() unmasks it again. 194 T-states
+void hccaTxIsr(void) __naked {
+
+  __asm
+    push af
+    push hl
+    ld a, (__hccaTxTail)
+    ld hl, __hccaTxHead
+    cp (hl)
+    jr z, hccaTxIsr_empty
+    ld hl, __hccaTxBuffer
+    add a, l
+    ld l, a
+    jr nc, hccaTxIsr_send
+    inc h
+  hccaTxIsr_send:
+    ld a, (hl)
+    out (0x80), a
+    ld a, (__hccaTxTail)
+    inc a
+    and HCCA_TX_BUFFER_SIZE - 1
+    ld (__hccaTxTail), a
+    jr hccaTxIsr_done
+  hccaTxIsr_empty:
+    ld a, (__interruptMask)
+    and 0xBF
+    ld (__interruptMask), a
+    ld l, a
+    ld a, IOPORTA
+    out (0x41), a
+    ld a, l
+    out (0x40), a
+  hccaTxIsr_done:
+    pop hl
+    pop af
+    ei
+    reti
+  __endasm;
+}
+
+// Sets up interrupt mode 2 with the vector table at INT_VECTOR_TABLE, called with interrupts disabled
+void initInterrupts() {
+
+  if (_interruptsInitialized)
+    return;
+
+  uint16_t* vectors = (uint16_t*)INT_VECTOR_TABLE;
+
+  vectors[INT_HCCARX] = (uint16_t)isrHccaRx;
+  vectors[INT_HCCATX] = (uint16_t)isrHccaTx;
+  vectors[INT_KEYBOARD] = (uint16_t)isrKeyboard;
+  vectors[INT_VDP] = (uint16_t)isrVdp;
+
+  __asm
+    ld a, (__vectorPage)
+    ld i, a
+    im 2
+  __endasm;
+
+  _interruptsInitialized = true;
+}
+
+void nabu_set_interrupt_handler(uint8_t source, void (*handler)(void)) {
+
+  uint8_t mask = 0x80 >> source;
+
+  __asm
+    di
+  __endasm;
+
+  initInterrupts();
+
+  _interruptHandlers[source] = handler;
+
+  if (handler != NULL)
+    setInterruptMask(_interruptMask | mask);
+  else
+    setInterruptMask(_interruptMask & ~mask);
+
+  __asm
+    ei
+  __endasm;
+}
+
+// Keyboard interrupt handler of the key buffer. Reading the key acknowledges the interrupt
+void keyboardInterrupt(void) {
+
+  uint8_t inKey = z80_inp(KEYBOARD);
+
+  // Status codes, not keys, see isKeyPressed()
+  if (inKey >= 0x90 && inKey <= 0x95)
+    return;
+
+  uint8_t next = (_keyHead + 1) & (KEY_BUFFER_SIZE - 1);
+
+  if (next == _keyTail)
+    return;
+
+  _keyBuffer[_keyHead] = inKey;
+  _keyHead = next;
+
+  KeyPending = 1;
+}
+
+void nabu_enable_key_buffer(bool enabled) {
+
+  _keyHead = 0;
+  _keyTail = 0;
+  KeyPending = 0;
+  _keyBuffered = enabled;
+
+  nabu_set_interrupt_handler(INT_KEYBOARD, enabled ? keyboardInterrupt : NULL);
+}
+
+uint8_t nabu_get_key() {
+
+  if (!KeyPending)
+    return 0;
+
+  uint8_t key = _keyBuffer[_keyTail];
+
+  // A key queued in between must not lose its flag
+  __critical {
+    _keyTail = (_keyTail + 1) & (KEY_BUFFER_SIZE - 1);
+    KeyPending = _keyHead != _keyTail;
+  }
+
+  return key;
 }
 
 uint8_t isKeyPressed() {
 
+  if (_keyBuffered) {
+
+    uint8_t key = nabu_get_key();
+
+    if (key)
+      LastKeyPressed = key;
+
+    return key;
+  }
+
   uint8_t status = z80_inp(KEYBOARD + 1);
 
   if (status & 0x02) {
@@ -55,52 +331,62 @@ uint8_t getChar() {
 
 void hcca_ReceiveModeStart() {
 
-  z80_outp(AYLATCH, IOPORTA);
-
-  z80_outp(AYDATA, 0x80);
+  setInterruptMask(_interruptMask | INT_MASK_HCCARX);
 }
 
 bool hcca_IsDataAvailable() {
 
-  z80_outp(AYLATCH, IOPORTB);
+  if (_hccaRxBuffered)
+    return _hccaRxHead != _hccaRxTail;
+
+  uint8_t r;
 
-  uint8_t r = z80_inp(AYDATA);
+  __critical {
+    z80_outp(AYLATCH, IOPORTB);
+
+    r = z80_inp(AYDATA);
+  }
 
   return (r & 0x02) == 0x00;
 }
 
 void hcca_ReceiveModeStop() {
 
-  z80_outp(AYLATCH, IOPORTA);
-
-  z80_outp(AYDATA, 0);
+  setInterruptMask(_interruptMask & ~INT_MASK_HCCARX);
 }
 
 void hcca_TransmitModeStart() {
 
-  z80_outp(AYLATCH, IOPORTA);
-
-  z80_outp(AYDATA, 0x40);
+  setInterruptMask(_interruptMask | INT_MASK_HCCATX);
 }
 
 bool hcca_IsTransmitBufferEmpty() {
 
-  z80_outp(AYLATCH, IOPORTB);
+  uint8_t r;
 
-  uint8_t r = z80_inp(AYDATA);
+  __critical {
+    z80_outp(AYLATCH, IOPORTB);
+
+    r = z80_inp(AYDATA);
+  }
 
   return (r & 64) == 0;
 }
 
 void hcca_TransmitModeStop() {
 
-  z80_outp(AYLATCH, IOPORTA);
-
-  z80_outp(AYDATA, 0);
+  setInterruptMask(_interruptMask & ~INT_MASK_HCCATX);
 }
 
 void hcca_WriteByte(uint8_t c) {
 
+  if (_hccaTxQueued) {
+
+    while (hcca_send(&c, 1) == 0);
+
+    return;
+  }
+
   hcca_ReceiveModeStop();
 
   hcca_TransmitModeStart();
@@ -120,12 +406,31 @@ void hcca_WriteString(uint8_t* str) {
 
 void hcca_WriteBytes(uint8_t* str, uint8_t len) {
 
+  if (_hccaTxQueued) {
+
+    for (uint8_t sent = 0; sent < len;)
+      sent += hcca_send(str + sent, len - sent);
+
+    return;
+  }
+
   for (int i = 0; i < len; i++)
     hcca_WriteByte(str[i]);
 }
 
 uint8_t hcca_readByte() {
 
+  if (_hccaRxBuffered) {
+
+    while (_hccaRxHead == _hccaRxTail);
+
+    uint8_t r = _hccaRxBuffer[_hccaRxTail];
+
+    _hccaRxTail = (_hccaRxTail + 1) & (HCCA_RX_BUFFER_SIZE - 1);
+
+    return r;
+  }
+
   hcca_ReceiveModeStop();
 
   int8_t r = z80_inp(HCCA);
@@ -135,13 +440,1151 @@ uint8_t hcca_readByte() {
   return r;
 }
 
+void hcca_enable_rx_buffer(bool enabled) {
+
+  __asm
+    di
+  __endasm;
+
+  initInterrupts();
+
+  _hccaRxHead = 0;
+  _hccaRxTail = 0;
+  _hccaRxOverflow = false;
+  _hccaRxBuffered = enabled;
+
+  // The buffer bypasses the C handler dispatch of isrHccaRx()
+  uint16_t* vectors = (uint16_t*)INT_VECTOR_TABLE;
+
+  vectors[INT_HCCARX] = enabled ? (uint16_t)hccaRxIsr : (uint16_t)isrHccaRx;
+
+  if (enabled)
+    setInterruptMask(_interruptMask | INT_MASK_HCCARX);
+  else if (_interruptHandlers[INT_HCCARX] == NULL)
+    setInterruptMask(_interruptMask & ~INT_MASK_HCCARX);
+
+  __asm
+    ei
+  __endasm;
+}
+
+uint8_t hcca_available() {
+
+  return (_hccaRxHead - _hccaRxTail) & (HCCA_RX_BUFFER_SIZE - 1);
+}
+
+bool hcca_rx_overflow() {
+
+  bool overflow = _hccaRxOverflow;
+
+  _hccaRxOverflow = false;
+
+  return overflow;
+}
+
+uint16_t hcca_read(uint8_t* buf, uint16_t len) {
+
+  uint8_t head = _hccaRxHead;
+  uint8_t tail = _hccaRxTail;
+  uint16_t count = 0;
+
+  while (count < len && tail != head) {
+
+    // Copy the run up to the head or the end of the buffer
+    uint16_t run = (head > tail ? head : HCCA_RX_BUFFER_SIZE) - tail;
+
+    if (run > len - count)
+      run = len - count;
+
+    memcpy(buf + count, _hccaRxBuffer + tail, run);
+
+    count += run;
+    tail = (tail + run) & (HCCA_RX_BUFFER_SIZE - 1);
+
+    // Free the space for the interrupt routine right away
+    _hccaRxTail = tail;
+  }
+
+  return count;
+}
+
+void hcca_enable_tx_queue(bool enabled) {
+
+  // Let the queued bytes go out first
+  if (!enabled)
+    while (_hccaTxHead != _hccaTxTail);
+
+  __asm
+    di
+  __endasm;
+
+  initInterrupts();
+
+  _hccaTxHead = 0;
+  _hccaTxTail = 0;
+  _hccaTxQueued = enabled;
+
+  // The queue bypasses the C handler dispatch of isrHccaTx()
+  uint16_t* vectors = (uint16_t*)INT_VECTOR_TABLE;
+
+  vectors[INT_HCCATX] = enabled ? (uint16_t)hccaTxIsr : (uint16_t)isrHccaTx;
+
+  // hcca_send() unmasks the transmit interrupt when there is something to send
+  if (_interruptHandlers[INT_HCCATX] == NULL)
+    setInterruptMask(_interruptMask & ~INT_MASK_HCCATX);
+
+  __asm
+    ei
+  __endasm;
+}
+
+uint16_t hcca_send(uint8_t* buf, uint16_t len) {
+
+  uint8_t head = _hccaTxHead;
+  uint8_t tail = _hccaTxTail;
+  uint16_t count = 0;
+
+  // One slot stays free to tell a full queue from an empty one
+  while (count < len && ((head + 1) & (HCCA_TX_BUFFER_SIZE - 1)) != tail) {
+
+    // Copy the run up to the slot before the tail or the end of the buffer
+    uint16_t run = (tail > head ? tail - 1 : (tail == 0 ? HCCA_TX_BUFFER_SIZE - 1 : HCCA_TX_BUFFER_SIZE)) - head;
+
+    if (run > len - count)
+      run = len - count;
+
+    memcpy(_hccaTxBuffer + head, buf + count, run);
+
+    count += run;
+    head = (head + run) & (HCCA_TX_BUFFER_SIZE - 1);
+  }
+
+  if (count == 0)
+    return 0;
+
+  _hccaTxHead = head;
+
+  // Start the burst, the interrupt routine masks itself again once the queue is empty
+  __critical {
+    if (!(_interruptMask & INT_MASK_HCCATX))
+      setInterruptMask(_interruptMask | INT_MASK_HCCATX);
+  }
+
+  return count;
+}
+
+uint8_t hcca_tx_pending() {
+
+  return (_hccaTxHead - _hccaTxTail) & (HCCA_TX_BUFFER_SIZE - 1);
+}
+
+// Writes an AY register of the sound engine unless it already has the value
+void soundWrite(uint8_t reg, uint8_t val) {
+
+  if (_ayRegisters[reg] == val)
+    return;
+
+  _ayRegisters[reg] = val;
+
+  ayWrite(reg, val);
+}
+
 void beep(int pitch, uint16_t ms) {
 
-  ayWrite(0, pitch);
-  ayWrite(1, 1);
+  // Through the shadow, so that sound_tick() does not skip writes it thinks the AY already has
+  soundWrite(0, pitch);
+  soundWrite(1, 1);
 
   z80_delay_ms(ms);
 
-  ayWrite(0, 0);
-  ayWrite(1, 0);
+  soundWrite(0, 0);
+  soundWrite(1, 0);
+}
+
+// Runs the commands of a channel up to its next note or rest, the channel goes silent at SND_END
+void soundStep(Sound_channel* c) {
+
+  bool looped = false;
+
+  while (true) {
+
+    uint8_t cmd = *c->pos++;
+
+    if (cmd & 0x80) {
+
+      c->period = ((cmd & 0x0F) << 8) | *c->pos++;
+      c->frames = *c->pos++;
+      c->level = c->volume;
+      c->decay_count = 0;
+
+      return;
+    }
+
+    switch (cmd & 0xF0) {
+
+      case 0x00:
+        c->pos = NULL;
+        return;
+
+      case 0x20:
+        c->mix = cmd;
+        break;
+
+      case 0x30:
+        if (cmd == SND_LOOP) {
+
+          // A second loop without a note or rest in between would never leave the interrupt
+          if (looped) {
+            c->pos = NULL;
+            return;
+          }
+
+          looped = true;
+          c->pos = c->start;
+        } else if (cmd == 0x31) {
+          c->frames = *c->pos++;
+          c->level = 0;
+          return;
+        } else {
+          c->slide = *c->pos++;
+        }
+        break;
+
+      case 0x40:
+        c->volume = cmd & 0x0F;
+        break;
+
+      case 0x50:
+        c->decay = cmd & 0x0F;
+        break;
+
+      default:
+        _soundNoise = cmd & 0x1F;
+        break;
+    }
+  }
+}
+
+void sound_play_channel(uint8_t channel, const uint8_t* sfx) {
+
+  if (!_soundStarted) {
+
+    // Silence and mixer off (bit 6 keeps IOPORTA an output), the shadow matches from here on
+    for (uint8_t reg = 0; reg < 11; reg++)
+      ayWrite(reg, _ayRegisters[reg] = reg == 7 ? 0x7F : 0);
+
+    _soundStarted = true;
+  }
+
+  Sound_channel* c = &_soundChannels[channel];
+
+  __critical {
+    c->start = sfx;
+    c->pos = sfx;
+    c->slide = 0;
+    c->frames = 0;
+    c->volume = 15;
+    c->level = 0;
+    c->decay = 0;
+    c->mix = SND_TONE;
+  }
+}
+
+uint8_t sound_play(const uint8_t* sfx) {
+
+  uint8_t channel = 0;
+
+  while (channel < 2 && _soundChannels[channel].pos != NULL)
+    channel++;
+
+  sound_play_channel(channel, sfx);
+
+  return channel;
+}
+
+void sound_stop(uint8_t channel) {
+
+  _soundChannels[channel].pos = NULL;
+}
+
+bool sound_is_playing(uint8_t channel) {
+
+  return _soundChannels[channel].pos != NULL;
+}
+
+void sound_tick() {
+
+  if (!_soundStarted)
+    return;
+
+  uint8_t mixer = 0x7F;
+
+  for (uint8_t i = 0; i < 3; i++) {
+
+    Sound_channel* c = &_soundChannels[i];
+
+    if (c->pos != NULL && c->frames == 0)
+      soundStep(c);
+
+    if (c->pos == NULL) {
+
+      soundWrite(8 + i, 0);
+      continue;
+    }
+
+    c->frames--;
+
+    if (c->level != 0) {
+
+      // Tone and noise enable bits are active low
+      if (c->mix & 0x01)
+        mixer &= ~(0x01 << i);
+
+      if (c->mix & 0x02)
+        mixer &= ~(0x08 << i);
+
+      soundWrite(2 * i, c->period & 0xFF);
+      soundWrite(2 * i + 1, (c->period >> 8) & 0x0F);
+
+      c->period += c->slide;
+
+      if (c->decay != 0 && ++c->decay_count == c->decay) {
+
+        c->decay_count = 0;
+        c->level--;
+      }
+    }
+
+    soundWrite(8 + i, c->level);
+  }
+
+  soundWrite(6, _soundNoise);
+  soundWrite(7, mixer);
+}
+
+// Waits for a byte from the adaptor, -1 after a few seconds without one
+int16_t hccaGetByte() {
+
+  for (uint16_t i = 0; i != 0xFFFF; i++)
+    if (hcca_IsDataAvailable())
+      return hcca_readByte();
+
+  return -1;
+}
+
+// Reads two bytes from the adaptor, true if they are a and b
+bool hccaExpect(uint8_t a, uint8_t b) {
+
+  return hccaGetByte() == a && hccaGetByte() == b;
+}
+
+// Returned by hccaGetEscaped() besides a byte or -1 for a timeout
+#define HCCA_END_MARK   -2    // 0x10 0xE1
+#define HCCA_BAD_ESCAPE -3    // 0x10 followed by anything else
+
+// Returned by receivePack() besides the payload length
+#define PACK_TIMEOUT  -1
+#define PACK_BAD      -2      // Broken escape or wrong CRC
+#define PACK_TOO_LONG -3
+
+// Reads one byte of an escaped transfer, where 0x10 is sent as 0x10 0x10 and 0x10 0xE1 ends the transfer
+int16_t hccaGetEscaped() {
+
+  int16_t c = hccaGetByte();
+
+  if (c != 0x10)
+    return c;
+
+  c = hccaGetByte();
+
+  if (c == 0xE1)
+    return HCCA_END_MARK;
+
+  if (c == 0x10)
+    return c;
+
+  return c == -1 ? -1 : HCCA_BAD_ESCAPE;
+}
+
+// Reads the rest of an escaped transfer up to its end mark, false on a timeout
+bool hccaSkipEscaped() {
+
+  int16_t c;
+
+  while ((c = hccaGetEscaped()) != HCCA_END_MARK)
+    if (c == -1)
+      return false;
+
+  return true;
+}
+
+// Masks the VDP frame interrupt for the length of a transfer, true if it was on. Its handler runs with
+// interrupts disabled for longer than a byte takes on the line, and the UART only holds one byte, so a
+// byte waiting for the receive interrupt until then would be overwritten by the next one unnoticed
+bool hccaHoldFrames() {
+
+  if (!(_interruptMask & INT_MASK_VDP))
+    return false;
+
+  setInterruptMask(_interruptMask & ~INT_MASK_VDP);
+
+  return true;
+}
+
+// Unmasks the VDP frame interrupt again if hccaHoldFrames() masked it, the frames in between are skipped
+void hccaResumeFrames(bool held) {
+
+  if (held)
+    setInterruptMask(_interruptMask | INT_MASK_VDP);
+}
+
+// hccaDrain() arguments and result, handed to its assembly loop through globals
+// so they do not depend on the compiler's calling convention
+uint16_t _streamPos;    // Address of the next byte in RAM, or the number of bytes written to VRAM
+uint16_t _streamStop;   // _streamPos to stop at
+bool _streamToRam;      // Write to RAM at _streamPos rather than to the VDP data port
+int8_t _streamEnd;      // Why the loop stopped early: HCCA_END_MARK, HCCA_BAD_ESCAPE, -1 for a timeout, else 0
+
+// Drains an escaped transfer from the ring buffer into RAM or the VDP data port until _streamPos gets to
+// _streamStop or the transfer stops early. Each pass takes the bytes that have arrived, up to the end of
+// the buffer and at most the bytes still to write, and frees them at once. 53 T-states per byte to RAM
+// and 57 to the VDP within a pass, so that together with the 202 of the receive interrupt it stays ahead
+// of the 320 T-states a byte takes on the line.
+// B: bytes left in the pass, C: bit 0 for RAM, bit 4 if the pass ended halfway through an escape,
+// DE: _streamPos, HL: next byte in the buffer
+void hccaDrain() {
+
+  __asm
+    xor a
+    ld (__streamEnd), a
+    ld a, (__streamToRam)
+    ld c, a
+    ld de, (__streamPos)
+    ld hl, (__streamStop)
+    or a
+    sbc hl, de
+    jp z, hccaDrain_done
+
+  hccaDrain_wait:
+    ; Gives up after 65535 polls without a byte, about as long as hccaGetByte()
+    ld hl, 0
+  hccaDrain_poll:
+    ld a, (__hccaRxTail)
+    ld b, a
+    ld a, (__hccaRxHead)
+    sub b
+    and HCCA_RX_BUFFER_SIZE - 1
+    jr nz, hccaDrain_pass
+    dec hl
+    ld a, h
+    or l
+    jr nz, hccaDrain_poll
+    dec a
+    ld (__streamEnd), a
+    jp hccaDrain_done
+
+  hccaDrain_pass:
+    ld l, b
+    ld b, a
+
+    ; Not past the end of the buffer
+    ld a, HCCA_RX_BUFFER_SIZE - 1
+    sub l
+    cp b
+    jr nc, hccaDrain_in_buffer
+    inc a
+    ld b, a
+  hccaDrain_in_buffer:
+
+    ; Not more than the bytes still to write, which need at least as many escaped bytes
+    push hl
+    ld hl, (__streamStop)
+    or a
+    sbc hl, de
+    ld a, h
+    or a
+    jr nz, hccaDrain_in_len
+    ld a, l
+    cp b
+    jr nc, hccaDrain_in_len
+    ld b, a
+  hccaDrain_in_len:
+    pop hl
+
+    push de
+    ld e, l
+    ld d, 0
+    ld hl, __hccaRxBuffer
+    add hl, de
+    pop de
+
+    bit 4, c
+    jr z, hccaDrain_first
+    res 4, c
+    ld a, (hl)
+    jr hccaDrain_second
+  hccaDrain_first:
+    bit 0, c
+    jr nz, hccaDrain_ram
+
+  hccaDrain_vdp:
+    ld a, (hl)
+    cp 0x10
+    jr z, hccaDrain_escape
+  hccaDrain_out:
+    out (0xA0), a
+    inc de
+    inc hl
+    djnz hccaDrain_vdp
+    jr hccaDrain_free
+
+  hccaDrain_ram:
+    ld a, (hl)
+    cp 0x10
+    jr z, hccaDrain_escape
+  hccaDrain_store:
+    ld (de), a
+    inc de
+    inc hl
+    djnz hccaDrain_ram
+
+  hccaDrain_free:
+    ; The new tail is where HL got to
+    push de
+    ld de, __hccaRxBuffer
+    or a
+    sbc hl, de
+    pop de
+    ld a, l
+    and HCCA_RX_BUFFER_SIZE - 1
+    ld (__hccaRxTail), a
+    ld a, (__streamEnd)
+    or a
+    jr nz, hccaDrain_done
+    ld hl, (__streamStop)
+    sbc hl, de
+    jr nz, hccaDrain_wait
+    jr hccaDrain_done
+
+  hccaDrain_escape:
+    inc hl
+    dec b
+    jr nz, hccaDrain_split_done
+    set 4, c
+    jr hccaDrain_free
+  hccaDrain_split_done:
+    ld a, (hl)
+  hccaDrain_second:
+    ; 0x10 0x10 is a 0x10 of data, 0x10 0xE1 the end mark, anything else a broken escape
+    cp 0x10
+    jr nz, hccaDrain_mark
+    bit 0, c
+    jr z, hccaDrain_out
+    jr hccaDrain_store
+  hccaDrain_mark:
+    cp 0xE1
+    ld a, HCCA_END_MARK & 0xFF
+    jr z, hccaDrain_end
+    ld a, HCCA_BAD_ESCAPE & 0xFF
+  hccaDrain_end:
+    ld (__streamEnd), a
+    inc hl
+    jr hccaDrain_free
+
+  hccaDrain_done:
+    ld (__streamPos), de
+  __endasm;
+}
+
+// Receives up to len bytes of an escaped transfer into buf with hccaDrain(), stopping early like
+// hcca_stream_to_vram(). Returns the number of bytes received, _streamEnd tells why it stopped
+uint16_t hccaReceive(uint8_t* buf, uint16_t len) {
+
+  _streamPos = (uint16_t)buf;
+  _streamStop = _streamPos + len;
+  _streamToRam = true;
+
+  hccaDrain();
+
+  return _streamPos - (uint16_t)buf;
+}
+
+// crc16Block() arguments and result, handed to its assembly loop through globals like those of hccaDrain()
+uint8_t* _crcData;
+uint16_t _crcLen;
+uint16_t _crcValue;
+
+// Adds the _crcLen bytes at _crcData to the CRC-16/GENIBUS (polynomial 0x1021, msb first) in _crcValue,
+// without a table. Per byte b that is crc = swap(crc) ^ b, crc ^= (crc & 0xFF) >> 4, crc ^= crc << 12,
+// crc ^= (crc & 0xFF) << 5. 142 T-states per byte.
+// B: bytes left in the round, C: rounds left, then the low byte rotated, DE: CRC, HL: next byte
+void crc16Block() {
+
+  __asm
+    ld hl, (__crcData)
+    ld de, (__crcValue)
+    ld bc, (__crcLen)
+    ld a, b
+    or c
+    jr z, crcBlock_done
+
+    ; 256 bytes a round, the first takes the rest
+    ld a, c
+    dec bc
+    inc b
+    ld c, b
+    ld b, a
+
+  crcBlock_round:
+    push bc
+  crcBlock_byte:
+    ld a, (hl)
+    xor d
+    ld d, a
+    rrca
+    rrca
+    rrca
+    rrca
+    and 0x0F
+    xor d
+    ld d, a
+    rrca
+    rrca
+    rrca
+    ld c, a
+    and 0x1F
+    xor e
+    ld e, a
+    ld a, c
+    rrca
+    and 0xF0
+    xor e
+    ld e, a
+    ld a, c
+    and 0xE0
+    xor d
+    ld d, e
+    ld e, a
+    inc hl
+    djnz crcBlock_byte
+    pop bc
+    ld b, 0
+    dec c
+    jr nz, crcBlock_round
+
+  crcBlock_done:
+    ld (__crcValue), de
+  __endasm;
+}
+
+// Receives an escaped pack up to its end mark, see nabu_get_pack(). The header goes to header, the payload
+// to dest, and with it the two CRC bytes at its end if there is room, the CRC to crc. The bytes go straight
+// from the ring buffer to RAM, checking the CRC with packCrcOk() is left until the pack is in. Unless it
+// times out, the end mark is read even if the pack is no good, so that the next transfer can follow
+int16_t receivePack(uint8_t* header, uint8_t* dest, uint16_t max, uint16_t* crc) {
+
+  uint16_t count = hccaReceive(header, NABU_PACK_HEADER_SIZE);
+  uint16_t len = 0;
+  uint8_t extra[2];
+  uint8_t extra_len = 0;
+
+  if (_streamEnd == 0)
+    len = hccaReceive(dest, max);
+
+  int16_t c = _streamEnd;
+
+  // dest is full, at most the CRC may follow before the end mark
+  while (c == 0) {
+
+    c = hccaGetEscaped();
+
+    if (c >= 0) {
+
+      if (extra_len == 2)
+        return hccaSkipEscaped() ? PACK_TOO_LONG : PACK_TIMEOUT;
+
+      extra[extra_len++] = c;
+      c = 0;
+    }
+  }
+
+  if (c == -1)
+    return PACK_TIMEOUT;
+
+  if (c == HCCA_BAD_ESCAPE)
+    return hccaSkipEscaped() ? PACK_BAD : PACK_TIMEOUT;
+
+  len += extra_len;
+
+  if (count < NABU_PACK_HEADER_SIZE || len < 2)
+    return PACK_BAD;
+
+  // The last two bytes are the CRC, msb first
+  len -= 2;
+
+  uint8_t hi = len < max ? dest[len] : extra[len - max];
+  uint8_t lo = len + 1 < max ? dest[len + 1] : extra[len + 1 - max];
+
+  *crc = ((uint16_t)hi << 8) | lo;
+
+  return len;
+}
+
+// True if crc from the end of a pack matches its header and len bytes of payload, it is stored inverted
+bool packCrcOk(uint8_t* header, uint8_t* dest, uint16_t len, uint16_t crc) {
+
+  _crcValue = 0xFFFF;
+  _crcData = header;
+  _crcLen = NABU_PACK_HEADER_SIZE;
+
+  crc16Block();
+
+  _crcData = dest;
+  _crcLen = len;
+
+  crc16Block();
+
+  return crc == (_crcValue ^ 0xFFFF);
+}
+
+// Requests one pack and receives it, see nabu_get_pack(). Returns the payload length or a PACK_ error
+int16_t getPack(uint32_t segment, uint8_t pack, uint8_t* header, uint8_t* dest, uint16_t max) {
+
+  uint8_t request[4] = {pack, segment & 0xFF, (segment >> 8) & 0xFF, (segment >> 16) & 0xFF};
+  uint16_t crc;
+
+  hcca_rx_overflow();
+
+  hcca_WriteByte(0x84);
+
+  if (!hccaExpect(0x10, 0x06))
+    return PACK_TIMEOUT;
+
+  hcca_WriteBytes(request, 4);
+
+  // 0x91: the pack is available
+  if (!hccaExpect(0xE4, 0x91))
+    return PACK_TIMEOUT;
+
+  hcca_WriteByte(0x10);
+  hcca_WriteByte(0x06);
+
+  int16_t len = receivePack(header, dest, max, &crc);
+
+  if (len < 0)
+    return len;
+
+  // Bytes the ring buffer had no room for are missing from the pack
+  if (hcca_rx_overflow() || !packCrcOk(header, dest, len, crc))
+    return PACK_BAD;
+
+  return len;
+}
+
+int16_t nabu_get_pack(uint32_t segment, uint8_t pack, uint8_t* header, uint8_t* dest, uint16_t max) {
+
+  // Turned on before the request, turning it on resets the buffer
+  if (!_hccaRxBuffered)
+    hcca_enable_rx_buffer(true);
+
+  bool frames = hccaHoldFrames();
+  int16_t len = getPack(segment, pack, header, dest, max);
+
+  hccaResumeFrames(frames);
+
+  return len < 0 ? -1 : len;
+}
+
+int32_t nabu_load_segment(uint32_t segment, uint8_t* dest, uint16_t max) {
+
+  uint8_t header[NABU_PACK_HEADER_SIZE];
+  uint16_t size = 0;
+
+  if (!_hccaRxBuffered)
+    hcca_enable_rx_buffer(true);
+
+  bool frames = hccaHoldFrames();
+
+  for (uint8_t pack = 0;; pack++) {
+
+    int16_t len = getPack(segment, pack, header, dest + size, max - size);
+
+    // Asks again for a pack that timed out or arrived broken, one too long for dest stays too long
+    for (uint8_t tries = 1; tries < NABU_PACK_RETRIES && (len == PACK_TIMEOUT || len == PACK_BAD); tries++)
+      len = getPack(segment, pack, header, dest + size, max - size);
+
+    if (len < 0) {
+
+      hccaResumeFrames(frames);
+
+      return -1;
+    }
+
+    size += len;
+
+    // Pack type bit 4 marks the last pack of the segment
+    if (header[11] & 0x10) {
+
+      hccaResumeFrames(frames);
+
+      return size;
+    }
+  }
+}
+
+// Sends a reply to the bulk download, see nabu_bulk_load_segment()
+void bulkReply(uint8_t reply, uint8_t expected) {
+
+  uint8_t bytes[2] = {reply, expected};
+
+  hcca_WriteBytes(bytes, 2);
+}
+
+// Downloads a segment with request 0xA0, see nabu_bulk_load_segment(). Each round takes in a window of packs
+// at the line rate and only then checks their CRCs, while the adaptor waits for the reply to the window
+int32_t bulkLoadSegment(uint32_t segment, uint8_t* dest, uint16_t max) {
+
+  uint8_t request[5] = {segment & 0xFF, (segment >> 8) & 0xFF, (segment >> 16) & 0xFF, 0, NABU_BULK_WINDOW};
+  uint8_t headers[NABU_BULK_WINDOW][NABU_PACK_HEADER_SIZE];
+  int16_t lens[NABU_BULK_WINDOW];
+  uint16_t crcs[NABU_BULK_WINDOW];
+  uint8_t expected = 0;
+  uint8_t failures = 0;
+  uint16_t size = 0;
+
+  hcca_WriteByte(0xA0);
+
+  if (!hccaExpect(0x10, 0x06))
+    return -1;
+
+  hcca_WriteBytes(request, 5);
+
+  // 0x91: the segment is available
+  if (!hccaExpect(0xE4, 0x91))
+    return -1;
+
+  while (true) {
+
+    uint16_t pos = size;
+    uint8_t got = 0;
+
+    hcca_rx_overflow();
+
+    // Up to a window of packs, fewer after the last one of the segment or once the line goes quiet
+    while (got < NABU_BULK_WINDOW) {
+
+      int16_t seq = hccaGetEscaped();
+
+      if (seq == -1)
+        break;
+
+      // Lost or damaged pack number, or a pack still sent before going back
+      if (seq != (uint8_t)(expected + got)) {
+
+        if (seq != HCCA_END_MARK && !hccaSkipEscaped())
+          break;
+
+        continue;
+      }
+
+      int16_t len = receivePack(headers[got], dest + pos, max - pos, &crcs[got]);
+
+      if (len == PACK_TIMEOUT)
+        break;
+
+      lens[got++] = len;
+
+      if (len < 0)
+        continue;
+
+      pos += len;
+
+      // Pack type bit 4 marks the last pack of the segment
+      if (headers[got - 1][11] & 0x10)
+        break;
+    }
+
+    // Bytes the ring buffer had no room for are missing from one of the packs
+    if (hcca_rx_overflow())
+      got = 0;
+
+    bool last = false;
+    uint8_t good = 0;
+
+    while (good < got && !last) {
+
+      if (lens[good] < 0 || !packCrcOk(headers[good], dest + size, lens[good], crcs[good]))
+        break;
+
+      size += lens[good];
+      last = headers[good][11] & 0x10;
+      good++;
+    }
+
+    // Acknowledges everything before expected
+    expected += good;
+
+    if (last) {
+
+      bulkReply(NABU_BULK_ACK, expected);
+
+      return size;
+    }
+
+    // Gives up after NABU_PACK_RETRIES windows in a row without a good pack. A pack too long for dest
+    // only ends it that way, two packs run together by a damaged end mark look just like one
+    if (good != 0) {
+
+      failures = 0;
+    } else if (++failures == NABU_PACK_RETRIES) {
+
+      bulkReply(NABU_BULK_CANCEL, expected);
+
+      return -1;
+    }
+
+    // Every round ends in a reply, so that a pack that is broken again gets another resend
+    bulkReply(good == NABU_BULK_WINDOW ? NABU_BULK_ACK : NABU_BULK_RESEND, expected);
+  }
+}
+
+int32_t nabu_bulk_load_segment(uint32_t segment, uint8_t* dest, uint16_t max) {
+
+  // Turned on before the request, turning it on resets the buffer
+  if (!_hccaRxBuffered)
+    hcca_enable_rx_buffer(true);
+
+  bool frames = hccaHoldFrames();
+  int32_t size = bulkLoadSegment(segment, dest, max);
+
+  hccaResumeFrames(frames);
+
+  return size;
+}
+
+// Sends a file service request and its arguments, true once the adaptor took them
+bool fileRequest(uint8_t request, uint8_t* args, uint8_t len) {
+
+  hcca_WriteByte(request);
+
+  if (!hccaExpect(0x10, 0x06))
+    return false;
+
+  hcca_WriteBytes(args, len);
+
+  return hccaGetByte() == 0xE4;
+}
+
+uint8_t nabu_file_open(const char* name) {
+
+  uint8_t len = strlen(name);
+
+  hcca_WriteByte(0xA1);
+
+  if (!hccaExpect(0x10, 0x06))
+    return NABU_NO_FILE;
+
+  hcca_WriteByte(len);
+  hcca_WriteBytes((uint8_t*)name, len);
+
+  if (hccaGetByte() != 0xE4)
+    return NABU_NO_FILE;
+
+  int16_t handle = hccaGetByte();
+
+  return handle < 0 ? NABU_NO_FILE : handle;
+}
+
+int32_t nabu_file_size(uint8_t handle) {
+
+  uint8_t size[4];
+
+  if (!fileRequest(0xA3, &handle, 1))
+    return -1;
+
+  for (uint8_t i = 0; i < 4; i++) {
+
+    int16_t c = hccaGetByte();
+
+    if (c < 0)
+      return -1;
+
+    size[i] = c;
+  }
+
+  // 0xFFFFFFFF for a handle that is not open
+  if (size[3] & 0x80)
+    return -1;
+
+  return ((uint32_t)size[3] << 24) | ((uint32_t)size[2] << 16) | ((uint16_t)size[1] << 8) | size[0];
+}
+
+int16_t nabu_file_read(uint8_t handle, uint32_t offset, uint8_t* buf, uint16_t len) {
+
+  uint8_t args[7] = {handle, offset & 0xFF, (offset >> 8) & 0xFF, (offset >> 16) & 0xFF, offset >> 24, len & 0xFF, len >> 8};
+  uint16_t count = 0;
+
+  // 0x91: the handle is open
+  if (!fileRequest(0xA2, args, 7) || hccaGetByte() != 0x91)
+    return -1;
+
+  while (true) {
+
+    int16_t c = hccaGetEscaped();
+
+    if (c == HCCA_END_MARK)
+      return count;
+
+    if (c < 0 || count == len)
+      return -1;
+
+    buf[count++] = c;
+  }
+}
+
+void nabu_file_close(uint8_t handle) {
+
+  fileRequest(0xA4, &handle, 1);
+}
+
+int16_t hcca_stream_to_vram(uint16_t vram_addr, uint16_t len) {
+
+  // Only the ring buffer keeps up with the line rate while the bytes go on to the VDP
+  if (!_hccaRxBuffered)
+    hcca_enable_rx_buffer(true);
+
+  bool frames = hccaHoldFrames();
+
+  _streamPos = 0;
+  _streamStop = len;
+  _streamToRam = false;
+
+  vdp_stream_begin(vram_addr);
+
+  hccaDrain();
+
+  vdp_stream_end();
+
+  hccaResumeFrames(frames);
+
+  // Bytes the ring buffer had no room for are missing somewhere in VRAM
+  if (hcca_rx_overflow() || (_streamEnd != 0 && _streamEnd != HCCA_END_MARK))
+    return -1;
+
+  return _streamPos;
+}
+
+int16_t nabu_file_to_vram(uint8_t handle, uint32_t offset, uint16_t vram_addr, uint16_t len) {
+
+  uint8_t args[7] = {handle, offset & 0xFF, (offset >> 8) & 0xFF, (offset >> 16) & 0xFF, offset >> 24, len & 0xFF, len >> 8};
+
+  // Turned on before the request, turning it on resets the buffer
+  if (!_hccaRxBuffered)
+    hcca_enable_rx_buffer(true);
+
+  hcca_rx_overflow();
+
+  bool frames = hccaHoldFrames();
+  int16_t count = -1;
+
+  // 0x91: the handle is open
+  if (fileRequest(0xA2, args, 7) && hccaGetByte() == 0x91) {
+
+    count = hcca_stream_to_vram(vram_addr, len);
+
+    // A full read leaves the end mark
+    if (count == len && hccaGetEscaped() != HCCA_END_MARK)
+      count = -1;
+  }
+
+  hccaResumeFrames(frames);
+
+  return count;
+}
+
+// Writes the runs of a 0xA5 reply to VRAM at vram_addr, see nabu_file_delta_to_vram()
+int16_t streamDeltaRuns(uint16_t vram_addr) {
+
+  int16_t runs = 0;
+
+  // Each run is its offset and length, lsb first, then its bytes. A run of length 0 ends the list
+  while (true) {
+
+    uint8_t run[4];
+
+    for (uint8_t i = 0; i < 4; i++) {
+
+      int16_t c = hccaGetEscaped();
+
+      if (c < 0)
+        return -1;
+
+      run[i] = c;
+    }
+
+    uint16_t run_len = run[2] | (run[3] << 8);
+
+    if (run_len == 0)
+      break;
+
+    if (hcca_stream_to_vram(vram_addr + (run[0] | (run[1] << 8)), run_len) != run_len)
+      return -1;
+
+    runs++;
+  }
+
+  if (hccaGetEscaped() != HCCA_END_MARK)
+    return -1;
+
+  return runs;
+}
+
+int16_t nabu_file_delta_to_vram(uint8_t handle, uint32_t offset, uint32_t previous, uint16_t vram_addr, uint16_t len) {
+
+  uint8_t args[11] = {handle,
+                      offset & 0xFF, (offset >> 8) & 0xFF, (offset >> 16) & 0xFF, offset >> 24,
+                      previous & 0xFF, (previous >> 8) & 0xFF, (previous >> 16) & 0xFF, previous >> 24,
+                      len & 0xFF, len >> 8};
+
+  // Turned on before the request, turning it on resets the buffer
+  if (!_hccaRxBuffered)
+    hcca_enable_rx_buffer(true);
+
+  hcca_rx_overflow();
+
+  bool frames = hccaHoldFrames();
+  int16_t runs = -1;
+
+  // 0x91: the handle is open
+  if (fileRequest(0xA5, args, 11) && hccaGetByte() == 0x91)
+    runs = streamDeltaRuns(vram_addr);
+
+  hccaResumeFrames(frames);
+
+  return runs;
+}
+
+void overlay_define(uint8_t region, uint8_t* addr, uint16_t size) {
+
+  _overlays[region].addr = addr;
+  _overlays[region].size = size;
+  _overlays[region].segment = NABU_NO_SEGMENT;
+}
+
+uint8_t* overlay_load(uint8_t region, uint32_t segment) {
+
+  Overlay_region* overlay = &_overlays[region];
+
+  if (overlay->segment == segment)
+    return overlay->addr;
+
+  // A partial download leaves nothing usable behind
+  overlay->segment = NABU_NO_SEGMENT;
+
+  if (nabu_load_segment(segment, overlay->addr, overlay->size) < 0)
+    return NULL;
+
+  overlay->segment = segment;
+
+  return overlay->addr;
 }
@@ -10,12 +10,118 @@
 
 uint8_t LastKeyPressed = 0x00;
 
+// Interrupt mask bits, written to IOPORTA
+#define INT_MASK_HCCARX   0x80
+#define INT_MASK_HCCATX   0x40
+#define INT_MASK_KEYBOARD 0x20
+#define INT_MASK_VDP      0x10
+
+// Interrupt sources, in IM2 vector table order
+#define INT_HCCARX   0
+#define INT_HCCATX   1
+#define INT_KEYBOARD 2
+#define INT_VDP      3
+
+// Page aligned address of the IM2 vector table, override with -DINT_VECTOR_TABLE=...
+#ifndef INT_VECTOR_TABLE
+#define INT_VECTOR_TABLE 0xff00
+#endif
+
+// Size of the HCCA receive ring buffer, a power of two up to 256, override with -DHCCA_RX_BUFFER_SIZE=...
+#ifndef HCCA_RX_BUFFER_SIZE
+#define HCCA_RX_BUFFER_SIZE 256
+#endif
+
+// Size of the HCCA transmit queue, a power of two up to 256, override with -DHCCA_TX_BUFFER_SIZE=...
+#ifndef HCCA_TX_BUFFER_SIZE
+#define HCCA_TX_BUFFER_SIZE 128
+#endif
+
+// Size of the keyboard buffer, a power of two up to 256, override with -DKEY_BUFFER_SIZE=...
+#ifndef KEY_BUFFER_SIZE
+#define KEY_BUFFER_SIZE 16
+#endif
+
+// Number of overlay regions, see overlay_define(), override with -DOVERLAY_MAX=...
+#ifndef OVERLAY_MAX
+#define OVERLAY_MAX 4
+#endif
+
+// Segment of an overlay region that has nothing loaded
+#define NABU_NO_SEGMENT 0xFFFFFFFF
+
+// Size of the header at the start of each pack, see nabu_get_pack()
+#define NABU_PACK_HEADER_SIZE 16
+
+// Times nabu_load_segment() asks for a pack that timed out or arrived broken before it gives up, and
+// windows in a row without a good pack nabu_bulk_load_segment() takes
+#ifndef NABU_PACK_RETRIES
+#define NABU_PACK_RETRIES 3
+#endif
+
+// Packs the adaptor may send ahead of the acknowledgements, see nabu_bulk_load_segment()
+#ifndef NABU_BULK_WINDOW
+#define NABU_BULK_WINDOW 4
+#endif
+
+// Replies of nabu_bulk_load_segment(), followed by the number of the next pack expected
+#define NABU_BULK_ACK    0x06
+#define NABU_BULK_RESEND 0x15
+#define NABU_BULK_CANCEL 0x18
+
+// Returned by nabu_file_open() when the file can't be opened
+#define NABU_NO_FILE 0xFF
+
+// Sound sequence commands, see sound_play(). A sequence is a list of commands ending with SND_END
+// or SND_LOOP, each SND_NOTE or SND_REST lasts 1 to 255 frames. A sequence that reaches SND_LOOP
+// without any SND_NOTE or SND_REST stops like at SND_END.
+#define SND_END                  0x00
+#define SND_TONE                 0x21                               // Notes play the tone only (default)
+#define SND_NOISE                0x22                               // Notes play the noise only
+#define SND_TONE_NOISE           0x23                               // Notes play tone and noise
+#define SND_LOOP                 0x30                               // Start the sequence over
+#define SND_REST(frames)         0x31, (frames)                     // Silence
+#define SND_SLIDE(delta)         0x32, (uint8_t)(delta)             // Add delta to the tone period every frame
+#define SND_VOLUME(volume)       (0x40 | (volume))                  // Volume 0-15 of the following notes (default 15)
+#define SND_DECAY(frames)        (0x50 | (frames))                  // Lower the volume by 1 every 1-15 frames, 0 to hold
+#define SND_NOISE_PERIOD(period) (0x60 | (period))                  // Noise period 0-31, shared by the channels
+#define SND_NOTE(period, frames) (0x80 | ((period) >> 8)), ((period) & 0xFF), (frames) // Tone period 1-4095
+
 inline void nop();
 
 void ayWrite(uint8_t reg, uint8_t val);
 
 uint8_t isKeyPressed();
 
+/// <summary>
+/// Nonzero while the keyboard buffer holds keys, see nabu_enable_key_buffer(). Cheap enough to check in hot loops
+/// </summary>
+extern volatile uint8_t KeyPending;
+
+/// <summary>
+/// Queue the keys from the keyboard interrupt, so that none are lost while the program is busy.
+/// While enabled, isKeyPressed() and getChar() take their keys from the buffer. Keys pressed while the buffer is full are dropped.
+/// </summary>
+void nabu_enable_key_buffer(bool enabled);
+
+/// <summary>
+/// Take the next key from the keyboard buffer, 0 if there is none. Does not wait
+/// </summary>
+uint8_t nabu_get_key();
+
+/// <summary>
+/// Install a handler for an interrupt source and unmask it. Passing NULL masks the source again.
+/// The first call sets up interrupt mode 2 with the vector table at INT_VECTOR_TABLE and enables interrupts.
+/// The handler is a plain function, called with interrupts disabled. A source that fires without
+/// a handler is masked, so the polling hcca_ functions can't be used while interrupts are enabled.
+/// </summary>
+void nabu_set_interrupt_handler(uint8_t source, void (*handler)(void));
+
+/// <summary>
+/// Set the interrupt mask register (IOPORTA). The hcca_ mode functions only change their own bits.
+/// </summary>
+void setInterruptMask(uint8_t mask);
+
 uint8_t getChar();
 
 /// <summary>
@@ -44,8 +150,161 @@ void hcca_WriteBytes(uint8_t* str, uint8_t len);
 
 uint8_t hcca_readByte();
 
+/// <summary>
+/// Receive HCCA bytes into a ring buffer from the receive interrupt, so that none are lost while the program
+/// is busy. The buffer has an assembly interrupt routine of its own instead of a nabu_set_interrupt_handler()
+/// handler, to keep up with the line rate. While enabled, hcca_IsDataAvailable() and hcca_readByte() read
+/// from the buffer. Bytes arriving while the buffer is full are dropped, see hcca_rx_overflow().
+/// </summary>
+void hcca_enable_rx_buffer(bool enabled);
+
+/// <summary>
+/// Number of received bytes waiting in the ring buffer
+/// </summary>
+uint8_t hcca_available();
+
+/// <summary>
+/// Copy up to len received bytes from the ring buffer to buf without waiting. Returns the number of bytes copied
+/// </summary>
+uint16_t hcca_read(uint8_t* buf, uint16_t len);
+
+/// <summary>
+/// True if the ring buffer dropped bytes because it was full since the last call or hcca_enable_rx_buffer()
+/// </summary>
+bool hcca_rx_overflow();
+
+/// <summary>
+/// Send HCCA bytes from a queue emptied by the transmit interrupt. The transmit interrupt is unmasked once per
+/// burst and masks itself when the queue runs empty, receiving stays on throughout. While enabled, the hcca_Write
+/// functions queue their bytes and only wait while the queue is full. Turning it off waits until the queue is sent.
+/// </summary>
+void hcca_enable_tx_queue(bool enabled);
+
+/// <summary>
+/// Queue up to len bytes of buf for sending without waiting. Returns the number of bytes queued
+/// </summary>
+uint16_t hcca_send(uint8_t* buf, uint16_t len);
+
+/// <summary>
+/// Number of queued bytes not sent yet
+/// </summary>
+uint8_t hcca_tx_pending();
+
 void beep(int pitch, uint16_t ms);
 
+/// <summary>
+/// Play a sequence of SND_ commands on a free AY channel, or on channel C when all three are busy.
+/// Returns the channel 0-2 right away, the sequence plays from sound_tick()
+/// </summary>
+uint8_t sound_play(const uint8_t* sfx);
+
+/// <summary>
+/// Play a sequence of SND_ commands on channel 0-2, replacing what it was playing, e.g. for music
+/// </summary>
+void sound_play_channel(uint8_t channel, const uint8_t* sfx);
+
+/// <summary>
+/// Silence channel 0-2
+/// </summary>
+void sound_stop(uint8_t channel);
+
+/// <summary>
+/// True while channel 0-2 has not reached the SND_END of its sequence
+/// </summary>
+bool sound_is_playing(uint8_t channel);
+
+/// <summary>
+/// Advance the sound engine by one frame. Call it 60 times a second, e.g. vdp_set_frame_handler(sound_tick)
+/// with the VDP interrupt enabled. Only the AY registers that change are written
+/// </summary>
+void sound_tick();
+
+/// <summary>
+/// Download one pack of a segment from the adaptor (request 0x84), the same way the boot loader does.
+/// The 16 byte pack header goes to header, the payload after it straight to dest, followed by the two CRC
+/// bytes at the end of the pack if there is room. The CRC is checked over header and payload. Receives
+/// through the ring buffer, which it turns on, with the VDP frame interrupt masked, see hcca_stream_to_vram().
+/// Returns the payload length, or -1 if the adaptor does not answer, the pack is longer than max, its CRC
+/// is wrong or the ring buffer overflowed
+/// </summary>
+int16_t nabu_get_pack(uint32_t segment, uint8_t pack, uint8_t* header, uint8_t* dest, uint16_t max);
+
+/// <summary>
+/// Download all packs of a segment to dest one after the other, up to the pack marked last in its header.
+/// A pack that times out or arrives broken is asked for again, up to NABU_PACK_RETRIES times in all.
+/// Returns the number of bytes loaded, or -1 once a pack still fails or does not fit into max
+/// </summary>
+int32_t nabu_load_segment(uint32_t segment, uint8_t* dest, uint16_t max);
+
+/// <summary>
+/// Download a segment like nabu_load_segment(), but with the bulk request 0xA0 of nabu-adaptor-emu.py: after a
+/// single request, the adaptor streams the packs back to back, each behind its pack number, keeping up to
+/// NABU_BULK_WINDOW packs ahead of the cumulative acknowledgements. A window comes in through the ring buffer,
+/// which it turns on, with the VDP frame interrupt masked, and its CRCs are checked before the reply to it. A
+/// broken or missing pack makes the adaptor go back to it, as often as that happens, until NABU_PACK_RETRIES
+/// windows in a row brought no good pack. Returns the number of bytes loaded, or -1 if the adaptor does not
+/// answer or the segment is longer than max
+/// </summary>
+int32_t nabu_bulk_load_segment(uint32_t segment, uint8_t* dest, uint16_t max);
+
+/// <summary>
+/// Open a file of the directory nabu-adaptor-emu.py serves to NABU programs (request 0xA1), read-only.
+/// Returns a handle for the other nabu_file_ functions, or NABU_NO_FILE
+/// </summary>
+uint8_t nabu_file_open(const char* name);
+
+/// <summary>
+/// Size of an open file in bytes, -1 if the handle is not open
+/// </summary>
+int32_t nabu_file_size(uint8_t handle);
+
+/// <summary>
+/// Read up to len bytes at offset of an open file into buf. Returns the number of bytes read, fewer
+/// at the end of the file, or -1 if the adaptor does not answer or the handle is not open
+/// </summary>
+int16_t nabu_file_read(uint8_t handle, uint32_t offset, uint8_t* buf, uint16_t len);
+
+/// <summary>
+/// Close an open file
+/// </summary>
+void nabu_file_close(uint8_t handle);
+
+/// <summary>
+/// Forward up to len bytes of the escaped transfer arriving on the HCCA straight to VRAM at vram_addr, undoing
+/// the 0x10 0x10 escapes on the way, without staging them in RAM. Stops early at the 0x10 0xE1 end mark, which
+/// is then read, otherwise the end mark is left for the caller. Needs the ring buffer and turns it on with
+/// hcca_enable_rx_buffer() if it is off, which is best done before the transfer is requested. Returns the number
+/// of bytes written, or -1 if the transfer breaks off or the ring buffer overflowed (hcca_rx_overflow()). The VDP
+/// frame interrupt is masked meanwhile, the frame handler misses the frames of the transfer
+/// </summary>
+int16_t hcca_stream_to_vram(uint16_t vram_addr, uint16_t len);
+
+/// <summary>
+/// Read up to len bytes at offset of an open file like nabu_file_read(), but straight into VRAM at vram_addr,
+/// e.g. a whole Graphics II screen. Turns on the ring buffer, see hcca_stream_to_vram(). Returns the number
+/// of bytes written, or -1
+/// </summary>
+int16_t nabu_file_to_vram(uint8_t handle, uint32_t offset, uint16_t vram_addr, uint16_t len);
+
+/// <summary>
+/// Update VRAM at vram_addr from showing len bytes at previous of an open file to showing the len bytes at offset,
+/// e.g. the next frame of a host rendered animation (request 0xA5). The adaptor only sends the runs of bytes that
+/// differ. Returns the number of runs written, or -1
+/// </summary>
+int16_t nabu_file_delta_to_vram(uint8_t handle, uint32_t offset, uint32_t previous, uint16_t vram_addr, uint16_t len);
+
+/// <summary>
+/// Set the RAM of overlay region 0 to OVERLAY_MAX - 1. The region forgets what it had loaded
+/// </summary>
+void overlay_define(uint8_t region, uint8_t* addr, uint16_t size);
+
+/// <summary>
+/// Make segment resident in an overlay region, downloading it only if the region holds something else.
+/// Overlay code has to be linked for the address of its region. Returns the region address, or NULL if
+/// the download failed, in which case the region has nothing loaded
+/// </summary>
+uint8_t* overlay_load(uint8_t region, uint32_t segment);
+
 #include "nabu.c"
 
 #endif
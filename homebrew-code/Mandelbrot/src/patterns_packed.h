@@ -0,0 +1,47 @@
+// Generated by vdp_pack.py from patterns.h, 768 bytes packed to 612
+#ifndef ASCII_PACKED_H
+#define ASCII_PACKED_H
+
+const uint8_t ASCII_packed[612] = {
+  0x00, 0x03, 0x13, 0x00, 0x01, 0x00, 0x10, 0x20, 0x01, 0x00, 0x61, 0x00, 0x20, 0x00, 0x50, 0x50,
+  0x50, 0x10, 0x00, 0xf0, 0x10, 0x50, 0x50, 0xf8, 0x50, 0xf8, 0x50, 0x50, 0x00, 0x20, 0x78, 0xa0,
+  0x70, 0x28, 0xf0, 0x20, 0x00, 0xc0, 0xc8, 0x10, 0x20, 0x40, 0x98, 0x18, 0x00, 0x40, 0xa0, 0xa0,
+  0x40, 0xa8, 0x90, 0x68, 0x30, 0x00, 0x02, 0x38, 0x00, 0xf0, 0x07, 0x40, 0x80, 0x80, 0x80, 0x40,
+  0x20, 0x00, 0x20, 0x10, 0x08, 0x08, 0x08, 0x10, 0x20, 0x00, 0x20, 0xa8, 0x70, 0x20, 0x70, 0xa8,
+  0x20, 0x51, 0x00, 0x13, 0xf8, 0x23, 0x00, 0x40, 0x00, 0x20, 0x20, 0x40, 0x07, 0x00, 0x14, 0xf8,
+  0x6c, 0x00, 0xf0, 0x07, 0x00, 0x00, 0x20, 0x00, 0x00, 0x08, 0x10, 0x20, 0x40, 0x80, 0x00, 0x00,
+  0x70, 0x88, 0x98, 0xa8, 0xc8, 0x88, 0x70, 0x00, 0x20, 0x60, 0x81, 0x00, 0xf0, 0x0f, 0x70, 0x00,
+  0x70, 0x88, 0x08, 0x30, 0x40, 0x80, 0xf8, 0x00, 0xf8, 0x08, 0x10, 0x30, 0x08, 0x88, 0x70, 0x00,
+  0x10, 0x30, 0x50, 0x90, 0xf8, 0x10, 0x10, 0x00, 0xf8, 0x80, 0xf0, 0x08, 0x10, 0x00, 0x70, 0x38,
+  0x40, 0x80, 0xf0, 0x88, 0x88, 0x70, 0x20, 0x00, 0x80, 0x20, 0x40, 0x40, 0x40, 0x00, 0x70, 0x88,
+  0x88, 0x03, 0x00, 0x00, 0x08, 0x00, 0x41, 0x78, 0x08, 0x10, 0xe0, 0x5c, 0x00, 0x03, 0x9a, 0x00,
+  0x01, 0x78, 0x00, 0x00, 0x66, 0x00, 0x31, 0x40, 0x20, 0x10, 0x7f, 0x00, 0x00, 0x81, 0x00, 0x30,
+  0x40, 0x20, 0x10, 0x3a, 0x00, 0x41, 0x00, 0x70, 0x88, 0x10, 0xf0, 0x00, 0xf0, 0x04, 0x70, 0x88,
+  0xa8, 0xb8, 0xb0, 0x80, 0x78, 0x00, 0x20, 0x50, 0x88, 0x88, 0xf8, 0x88, 0x88, 0x00, 0xf0, 0x88,
+  0x88, 0x03, 0x00, 0x80, 0x00, 0x70, 0x88, 0x80, 0x80, 0x80, 0x88, 0x70, 0x10, 0x00, 0x10, 0x88,
+  0x10, 0x00, 0x50, 0xf8, 0x80, 0x80, 0xf0, 0x80, 0x98, 0x00, 0x01, 0x08, 0x00, 0xb1, 0x80, 0x00,
+  0x78, 0x80, 0x80, 0x80, 0x98, 0x88, 0x78, 0x00, 0x88, 0x37, 0x00, 0x31, 0x88, 0x00, 0x70, 0x41,
+  0x01, 0x30, 0x70, 0x00, 0x08, 0x01, 0x00, 0xc1, 0x88, 0x70, 0x00, 0x88, 0x90, 0xa0, 0xc0, 0xa0,
+  0x90, 0x88, 0x00, 0x80, 0x01, 0x00, 0x60, 0xf8, 0x00, 0x88, 0xd8, 0xa8, 0xa8, 0x28, 0x00, 0x50,
+  0x88, 0x88, 0xc8, 0xa8, 0x98, 0x30, 0x00, 0x01, 0x58, 0x00, 0x01, 0x60, 0x00, 0x01, 0x50, 0x00,
+  0x00, 0x10, 0x00, 0x00, 0x58, 0x01, 0x00, 0x10, 0x00, 0x00, 0x38, 0x00, 0x40, 0x70, 0x88, 0x80,
+  0x70, 0x48, 0x00, 0x11, 0xf8, 0x58, 0x00, 0x10, 0x20, 0x68, 0x00, 0x01, 0x30, 0x00, 0x01, 0x07,
+  0x00, 0x11, 0x50, 0x10, 0x00, 0x30, 0xa8, 0xa8, 0xd8, 0x50, 0x00, 0x10, 0x50, 0xbb, 0x00, 0x01,
+  0x08, 0x00, 0x00, 0x28, 0x00, 0x01, 0x18, 0x01, 0x50, 0x80, 0xf8, 0x00, 0x78, 0x40, 0x01, 0x00,
+  0x30, 0x78, 0x00, 0x00, 0xfe, 0x00, 0x50, 0x08, 0x00, 0x00, 0xf0, 0x10, 0x01, 0x00, 0x10, 0xf0,
+  0x18, 0x01, 0x26, 0x50, 0x88, 0x89, 0x01, 0x12, 0xf8, 0x1c, 0x01, 0x00, 0x01, 0x00, 0x11, 0x70,
+  0x00, 0x01, 0x60, 0x00, 0x00, 0xf0, 0x48, 0x70, 0x48, 0x28, 0x00, 0x00, 0xe2, 0x00, 0x11, 0x78,
+  0x10, 0x00, 0x11, 0x48, 0x10, 0x00, 0x44, 0xf0, 0x80, 0xe0, 0x80, 0x08, 0x00, 0x11, 0x80, 0x20,
+  0x00, 0x62, 0xb8, 0x88, 0x70, 0x00, 0x00, 0x00, 0x38, 0x01, 0x11, 0x00, 0x02, 0x01, 0x00, 0x62,
+  0x01, 0x40, 0x70, 0x20, 0x20, 0xa0, 0x88, 0x01, 0x01, 0x01, 0x01, 0x21, 0x00, 0x00, 0x02, 0x01,
+  0x00, 0x18, 0x00, 0x31, 0x88, 0xd8, 0xa8, 0x28, 0x00, 0x01, 0x01, 0x01, 0x01, 0x70, 0x00, 0x00,
+  0xd0, 0x00, 0x30, 0x00, 0x00, 0xf0, 0x01, 0x01, 0x00, 0x8b, 0x00, 0x41, 0x88, 0xa8, 0x90, 0xe8,
+  0x08, 0x00, 0x11, 0xf8, 0x38, 0x00, 0x40, 0x78, 0x80, 0x70, 0x08, 0x70, 0x00, 0x01, 0x02, 0x01,
+  0x01, 0x68, 0x00, 0x02, 0x30, 0x00, 0x40, 0x88, 0x88, 0x90, 0xa0, 0x50, 0x02, 0x20, 0x88, 0x88,
+  0x00, 0x01, 0x61, 0x00, 0x00, 0x88, 0x60, 0x20, 0x60, 0x08, 0x00, 0x00, 0x01, 0x01, 0x00, 0x30,
+  0x00, 0xc5, 0x10, 0x20, 0x40, 0xf8, 0x00, 0x38, 0x40, 0x20, 0xc0, 0x20, 0x40, 0x38, 0xf0, 0x01,
+  0xa2, 0xe0, 0x10, 0x20, 0x18, 0x20, 0x10, 0xe0, 0x00, 0x40, 0xa8, 0xf0, 0x00, 0x21, 0xa8, 0x50,
+  0x02, 0x00, 0x10, 0x00,
+};
+
+#endif
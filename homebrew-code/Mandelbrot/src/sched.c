@@ -0,0 +1,176 @@
+// ****************************************************************************************
+// Cooperative task scheduler for the NABU PC
+// Each task has a stack of its own and gives up the CPU at its yield points. Sleeping
+// tasks wake on the 60 Hz frame tick, the CPU HALTs while nothing is ready to run.
+// **********************************************************************************************
+
+#define TASK_FREE     0
+#define TASK_READY    1
+#define TASK_SLEEPING 2
+
+typedef struct {
+  uint16_t sp;           // Stack pointer while switched out
+  uint16_t wake;         // Tick to wake up at while sleeping
+  void (*entry)(void);
+  uint8_t state;         // TASK_FREE, TASK_READY or TASK_SLEEPING
+} Task;
+
+// The main program is task 0 and always exists
+Task _tasks[TASK_MAX] = {{0, 0, NULL, TASK_READY}};
+uint8_t _taskCurrent = 0;
+uint8_t _taskResumedAt = 0;      // Low byte of the tick the current task got the CPU at
+
+volatile uint16_t _schedTicks = 0;
+
+// Where taskSwap() saves the stack pointer of the old task and which one it loads
+uint16_t* _taskSaveSp;
+uint16_t _taskLoadSp;
+
+void sched_tick() {
+
+  _schedTicks++;
+}
+
+uint16_t sched_ticks() {
+
+  uint16_t ticks;
+
+  // Two bytes the interrupt handler may change in between
+  __critical {
+    ticks = _schedTicks;
+  }
+
+  return ticks;
+}
+
+// Switches stacks. Mandelbrot is built with sccz80, which keeps no values in registers across a
+// call, so only what the z88dk libraries rely on has to survive: IX (also SDCC's frame pointer) and
+// IY (reserved by some targets' libraries). The stack of a switched out task ends with its IX, IY
+// and return address, which holds for both compilers.
+void taskSwap() __naked {
+
+  __asm
+    push ix
+    push iy
+    ld hl, 0
+    add hl, sp
+    ex de, hl
+    ld hl, (__taskSaveSp)
+    ld (hl), e
+    inc hl
+    ld (hl), d
+    ld sp, (__taskLoadSp)
+    pop iy
+    pop ix
+    ret
+  __endasm;
+}
+
+// First code of a new task, taskSwap() returns into it
+void taskStart() {
+
+  _taskResumedAt = (uint8_t)_schedTicks;
+
+  _tasks[_taskCurrent].entry();
+
+  task_exit();
+}
+
+uint8_t task_create(void (*entry)(void), uint8_t* stack, uint16_t size) {
+
+  for (uint8_t i = 1; i < TASK_MAX; i++) {
+
+    Task* t = &_tasks[i];
+
+    if (t->state != TASK_FREE)
+      continue;
+
+    // What taskSwap() pops: IY, IX and the address to return to
+    uint16_t* sp = (uint16_t*)(stack + size);
+
+    *--sp = (uint16_t)taskStart;
+    *--sp = 0;
+    *--sp = 0;
+
+    t->sp = (uint16_t)sp;
+    t->entry = entry;
+    t->state = TASK_READY;
+
+    return i;
+  }
+
+  return TASK_NONE;
+}
+
+void task_yield() {
+
+  while (true) {
+
+    uint16_t now = sched_ticks();
+    uint8_t next = _taskCurrent;
+
+    // The others in turn, then the current task itself
+    do {
+
+      if (++next == TASK_MAX)
+        next = 0;
+
+      Task* t = &_tasks[next];
+
+      if (t->state == TASK_SLEEPING && (int16_t)(now - t->wake) >= 0)
+        t->state = TASK_READY;
+
+      if (t->state == TASK_READY) {
+
+        if (next != _taskCurrent) {
+
+          _taskSaveSp = &_tasks[_taskCurrent].sp;
+          _taskLoadSp = t->sp;
+          _taskCurrent = next;
+
+          taskSwap();
+        }
+
+        _taskResumedAt = (uint8_t)_schedTicks;
+
+        return;
+      }
+    } while (next != _taskCurrent);
+
+    // Nothing can run before the next interrupt. With interrupts off (IFF2 in the parity flag)
+    // HALT would never return, keep polling instead
+    __asm
+      ld a, i
+      jp po, task_yield_poll
+      halt
+    task_yield_poll:
+    __endasm;
+  }
+}
+
+void task_poll() {
+
+  if ((uint8_t)_schedTicks != _taskResumedAt)
+    task_yield();
+}
+
+void task_sleep(uint16_t ticks) {
+
+  Task* t = &_tasks[_taskCurrent];
+
+  t->wake = sched_ticks() + ticks;
+  t->state = TASK_SLEEPING;
+
+  task_yield();
+}
+
+void task_exit() {
+
+  if (_taskCurrent == 0)
+    return;
+
+  _tasks[_taskCurrent].state = TASK_FREE;
+
+  // Never comes back, the task is not ready any more
+  task_yield();
+}
@@ -0,0 +1,54 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+// Number of tasks including the main program, override with -DTASK_MAX=...
+#ifndef TASK_MAX
+#define TASK_MAX 4
+#endif
+
+// Returned by task_create() when all tasks are in use
+#define TASK_NONE 0xFF
+
+/// <summary>
+/// Count one frame. Call it 60 times a second, e.g. vdp_set_frame_handler(sched_tick) with the VDP interrupt
+/// enabled. The tick is also what wakes task_yield() from HALT, so it has to run before tasks can sleep.
+/// </summary>
+void sched_tick();
+
+/// <summary>
+/// Number of frames counted by sched_tick(), wraps around after 65535
+/// </summary>
+uint16_t sched_ticks();
+
+/// <summary>
+/// Start entry as a task on its own stack of size bytes. The main program is task 0 and runs on the stack it
+/// already has. The task ends when entry returns. Returns the task number, or TASK_NONE if all are in use
+/// </summary>
+uint8_t task_create(void (*entry)(void), uint8_t* stack, uint16_t size);
+
+/// <summary>
+/// Let the next ready task run. Returns once every other task had its turn, or right away if none is ready.
+/// When no task at all is ready, the CPU HALTs until the next interrupt instead of spinning,
+/// unless interrupts are disabled.
+/// </summary>
+void task_yield();
+
+/// <summary>
+/// Yield if a frame tick passed since the task last got the CPU, otherwise return right away.
+/// Cheap enough to call often from long computations
+/// </summary>
+void task_poll();
+
+/// <summary>
+/// Yield for at least ticks frames, other tasks run meanwhile. Replaces z80_delay_ms()
+/// </summary>
+void task_sleep(uint16_t ticks);
+
+/// <summary>
+/// End the calling task, same as returning from its entry function. The main program can't exit
+/// </summary>
+void task_exit();
+
+#include "sched.c"
+
+#endif
@@ -27,6 +27,31 @@ enum VDP_MODES {
   VDP_MODE_TEXT = 3,
 };
 
+/**
+ * Modes compiled into the library. Define VDP_MODES_USED as an OR of these before tms9918.h is included
+ * (on the zcc command line when tms9918.c is compiled on its own) to leave out the code, font and text
+ * buffer of the other modes. With a single mode the mode checks are resolved at compile time.
+ */
+#define VDP_USE_G1 0x01
+#define VDP_USE_G2 0x02
+#define VDP_USE_MULTICOLOR 0x04
+#define VDP_USE_TEXT 0x08
+#define VDP_USE_ALL 0x0F
+
+#ifndef VDP_MODES_USED
+#define VDP_MODES_USED VDP_USE_ALL
+#endif
+
+#define VDP_HAS_MODE(mode) ((VDP_MODES_USED >> (mode)) & 1)
+
+#if VDP_MODES_USED & (VDP_USE_G1 | VDP_USE_G2 | VDP_USE_TEXT)
+#define VDP_HAS_FONT
+#endif
+
+#if VDP_MODES_USED & (VDP_USE_G1 | VDP_USE_TEXT)
+#define VDP_HAS_TEXT_BUFFER
+#endif
+
 enum VDP_CSR {
   VDP_CSR_UP = 0,
   VDP_CSR_DOWN = 1,
@@ -41,17 +66,115 @@ enum VDP_CSR {
 #define VDP_FLAG_COIN 0x20 
 /// 5th sprite flag, set when more than 4 sprite per line 
 #define VDP_FLAG_S5 0x40  
+/// Frame flag, set at the end of the active display area
+#define VDP_FLAG_FRAME 0x80
 
  /** Struct
   * 4-Byte record defining sprite attributes
   */
 typedef struct {
-  uint8_t x; //Sprite X position
   uint8_t y; //Sprite Y position
+  uint8_t x; //Sprite X position
   uint8_t name_ptr; //Sprite name in pattern table
   uint8_t ecclr; //Bit 7: Early clock bit, bit 3:0 color
 } Sprite_attributes;
 
+/**
+ * VRAM address of each table, see vdp_set_layout()
+ */
+typedef struct {
+  uint16_t name_table;
+  uint16_t pattern_table;
+  uint16_t color_table;
+  uint16_t sprite_attribute_table;
+  uint16_t sprite_pattern_table;
+} Vram_layout;
+
+/**
+ * First pattern slot of each Graphics II third that holds the font in tile text mode, see vdp_set_g2_text_tiles()
+ */
+#define VDP_G2_FONT_SLOT 160
+
+/**
+ * Tables for vdp_clear_tables() and vdp_reconfigure()
+ */
+#define VDP_TABLE_NAME 0x01
+#define VDP_TABLE_PATTERN 0x02
+#define VDP_TABLE_COLOR 0x04
+#define VDP_TABLE_SPRITE_ATTRIBUTES 0x08
+#define VDP_TABLE_SPRITE_PATTERNS 0x10
+#define VDP_TABLE_ALL 0x1F
+
+/**
+ * Number of named VRAM regions that can be reserved with vdp_reserve()
+ */
+#ifndef VDP_MAX_REGIONS
+#define VDP_MAX_REGIONS 8
+#endif
+
+/**
+ * Returned by vdp_alloc() and vdp_region() when there is no such region
+ */
+#define VDP_NO_REGION 0xFFFF
+
+/**
+ * Region holding the second pattern table while double buffering, see vdp_set_double_buffer()
+ */
+#define VDP_BACK_PAGE "back page"
+
+/**
+ * Pattern rows of the multicolor image, 8 pixels high each. 6 fill the screen, up to 8 give
+ * vdp_set_mc_viewport() an image of 64 by 64 pixels to pan over
+ */
+#ifndef VDP_MC_ROWS
+#define VDP_MC_ROWS 6
+#endif
+
+/**
+ * Size of the multicolor pattern table RAM shadow, see vdp_set_multicolor_shadow()
+ */
+#define VDP_MC_SHADOW_SIZE (VDP_MC_ROWS * 256)
+
+/**
+ * Size of each of the Graphics II pattern and color table RAM shadows, see vdp_set_g2_shadow()
+ */
+#define VDP_G2_SHADOW_SIZE 6144
+
+/**
+ * Number of logical sprites handled by the sprite multiplexer, at most 255
+ */
+#ifndef VDP_MAX_OBJECTS
+#define VDP_MAX_OBJECTS 64
+#endif
+
+/**
+ * Returned by vdp_object_add() when all logical sprites are in use
+ */
+#define VDP_NO_OBJECT 0xFF
+
+/**
+ * Changed console rows the frame interrupt writes to VRAM per frame, see vdp_console_write()
+ */
+#ifndef VDP_CONSOLE_IRQ_ROWS
+#define VDP_CONSOLE_IRQ_ROWS 3
+#endif
+
+/**
+ * Largest block accepted by vdp_queue_write()
+ */
+#define VDP_QUEUE_MAX_WRITE 128
+
+/**
+ * The port access and address kernels and vdp_plot_color() are written in assembly. They get pixel addresses by shuffling
+ * the coordinate bits, the TMS9918 table layout needs no row or column lookup tables. Define VDP_C_KERNELS to use the
+ * C versions instead
+ */
+#ifdef VDP_C_KERNELS
+#define VDP_FASTCALL
+#else
+#define VDP_FASTCALL __z88dk_fastcall
+#endif
+
 /**
  * VDP status
  */
@@ -70,6 +193,82 @@ typedef struct {
   */
 int vdp_init(uint8_t mode, uint8_t color, bool big_sprites, bool magnify);
 
+/**
+ * @brief Switch modes or sprite settings like vdp_init(), but only clear the tables named in tables.
+ * The others keep their VRAM contents, e.g. the multicolor name table and the sprite patterns between two pictures.
+ * vdp_reconfigure(..., VDP_TABLE_ALL) is the same as vdp_init().
+ *
+ * @param mode VDP_MODE_G1 | VDP_MODE_G2 | VDP_MODE_MULTICOLOR | VDP_MODE_TEXT
+ * @param color
+ * @param big_sprites true: Use 16x16 sprites false: use 8x8 sprites
+ * @param magnify true: Scale sprites up by 2
+ * @param tables OR of VDP_TABLE_* to clear
+ * @returns VDP_ERROR | VDP_OK
+ */
+int vdp_reconfigure(uint8_t mode, uint8_t color, bool big_sprites, bool magnify, uint8_t tables);
+
+/**
+ * @brief Put tables of the current mode back to how vdp_init() leaves them: cleared, with the font loaded in
+ * Graphics I and text mode, the name table of Graphics II and Multicolor mode written, RAM shadows cleared.
+ *
+ * @param tables OR of VDP_TABLE_*
+ */
+void vdp_clear_tables(uint8_t tables);
+
+/**
+ * @brief Place the tables of the next vdp_init() at layout instead of the default addresses of the mode.
+ * The addresses must be possible for the mode (e.g. pattern tables on a 2k boundary, 8k for Graphics II)
+ * and the tables must not overlap each other or a reserved region, otherwise vdp_init() fails.
+ *
+ * @param layout Copied, NULL to go back to the default layouts
+ * @returns VDP_OK
+ */
+int vdp_set_layout(const Vram_layout* layout);
+
+/**
+ * @brief Get the default table placement of a mode, as a starting point for vdp_set_layout()
+ *
+ * @param mode VDP_MODE_G1 | VDP_MODE_G2 | VDP_MODE_MULTICOLOR | VDP_MODE_TEXT
+ * @param layout Filled with the default addresses
+ */
+void vdp_default_layout(uint8_t mode, Vram_layout* layout);
+
+/**
+ * @brief Reserve a named VRAM region for the program, e.g. for cached images or sprite pattern banks.
+ * vdp_init() does not clear reserved regions and fails if a table would overlap one.
+ *
+ * @param name Name of the region, the string is not copied
+ * @param addr
+ * @param size
+ * @returns VDP_ERROR if the region overlaps a table of the current mode or another region | VDP_OK
+ */
+int vdp_reserve(const char* name, uint16_t addr, uint16_t size);
+
+/**
+ * @brief Reserve a named VRAM region at the lowest free address
+ *
+ * @param name Name of the region, the string is not copied
+ * @param size
+ * @param align Power of two the address must be a multiple of
+ * @returns Address of the region, VDP_NO_REGION if there is no room
+ */
+uint16_t vdp_alloc(const char* name, uint16_t size, uint16_t align);
+
+/**
+ * @brief Look up a reserved VRAM region
+ *
+ * @param name
+ * @returns Address of the region, VDP_NO_REGION if it is not reserved
+ */
+uint16_t vdp_region(const char* name);
+
+/**
+ * @brief Free a reserved VRAM region
+ *
+ * @param name
+ */
+void vdp_release(const char* name);
+
 /**
  * @brief Initializes the VDP in text mode
  *
@@ -136,11 +335,315 @@ void vdp_plot_hires(uint8_t x, uint8_t y, uint8_t color1, uint8_t color2);
  */
 void vdp_plot_color(uint8_t x, uint8_t y, uint8_t color);
 
-void writeByteToVRAM(unsigned char value);
+/**
+ * @brief Fill a rectangle with the pixels of vdp_plot_color(), in Multicolor or Graphics mode2.
+ * Bytes covering two pixels of the rectangle are written whole, each pattern's column in one auto-incremented run
+ *
+ * @param x
+ * @param y
+ * @param width
+ * @param height
+ * @param color
+ */
+void vdp_fill_rect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t color);
+
+/**
+ * @brief Draw a horizontal line of width pixels starting at (x,y), see vdp_fill_rect()
+ *
+ * @param x
+ * @param y
+ * @param width
+ * @param color
+ */
+void vdp_hline(uint8_t x, uint8_t y, uint8_t width, uint8_t color);
+
+/**
+ * @brief Draw a vertical line of height pixels starting at (x,y), see vdp_fill_rect()
+ *
+ * @param x
+ * @param y
+ * @param height
+ * @param color
+ */
+void vdp_vline(uint8_t x, uint8_t y, uint8_t height, uint8_t color);
+
+/**
+ * @brief Draw a line from (x0,y0) to (x1,y1) with the pixels of vdp_plot_color().
+ * Each horizontal or vertical run of the line is drawn with vdp_fill_rect()
+ *
+ * @param x0
+ * @param y0
+ * @param x1
+ * @param y1
+ * @param color
+ */
+void vdp_line(uint8_t x0, uint8_t y0, uint8_t x1, uint8_t y1, uint8_t color);
+
+/**
+ * @brief Fill a rectangle with the pixels of vdp_plot_hires(), VDP_MODE G2 only.
+ * Pattern bytes covering 8 pixels of the rectangle are filled without reading VRAM, only the partly covered bytes
+ * at the left and right edges are read back and masked. Each pattern's column is one auto-incremented run
+ *
+ * @param x
+ * @param y
+ * @param width
+ * @param height
+ * @param color1 Color of the pixels. If NULL, clear the pixels to color2
+ * @param color2 Color of the pixels not set, see vdp_plot_hires()
+ */
+void vdp_fill_rect_hires(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t color1, uint8_t color2);
+
+/**
+ * @brief Draw a horizontal line of width pixels starting at (x,y), see vdp_fill_rect_hires()
+ *
+ * @param x
+ * @param y
+ * @param width
+ * @param color1
+ * @param color2
+ */
+void vdp_hline_hires(uint8_t x, uint8_t y, uint8_t width, uint8_t color1, uint8_t color2);
+
+/**
+ * @brief Draw a vertical line of height pixels starting at (x,y), see vdp_fill_rect_hires()
+ *
+ * @param x
+ * @param y
+ * @param height
+ * @param color1
+ * @param color2
+ */
+void vdp_vline_hires(uint8_t x, uint8_t y, uint8_t height, uint8_t color1, uint8_t color2);
+
+/**
+ * @brief Draw a line from (x0,y0) to (x1,y1) with the pixels of vdp_plot_hires(), VDP_MODE G2 only.
+ * Each horizontal or vertical run of the line is drawn with vdp_fill_rect_hires()
+ *
+ * @param x0
+ * @param y0
+ * @param x1
+ * @param y1
+ * @param color1
+ * @param color2
+ */
+void vdp_line_hires(uint8_t x0, uint8_t y0, uint8_t x1, uint8_t y1, uint8_t color1, uint8_t color2);
+
+/**
+ * @brief Keep a RAM copy of the multicolor pattern table so that vdp_plot_color() does not have to read VRAM.
+ * The buffer is filled from VRAM when set and cleared by vdp_init().
+ *
+ * @param buffer VDP_MC_SHADOW_SIZE bytes owned by the caller, NULL to disable the shadow
+ */
+void vdp_set_multicolor_shadow(uint8_t* buffer);
+
+/**
+ * @brief Get the color of the pixel at position (x,y) in Multicolor mode.
+ * Read from the RAM shadow if one is set, otherwise from VRAM
+ *
+ * @param x
+ * @param y
+ * @returns color
+ */
+uint8_t vdp_get_color(uint8_t x, uint8_t y);
+
+/**
+ * @brief Pan the multicolor image by rewriting the name table, the patterns stay where they are.
+ * Pixel (x,y) of the image of 64 by VDP_MC_ROWS * 8 pixels is shown at the top left, the image wraps around at its edges.
+ * The name table holds one pattern per 2 by 8 pixels, x is rounded down to a multiple of 2 and y to a multiple of 8
+ *
+ * @param x
+ * @param y
+ * @returns VDP_ERROR | VDP_OK
+ */
+int vdp_set_mc_viewport(uint8_t x, uint8_t y);
+
+/**
+ * @brief Keep RAM copies of the Graphics II pattern and color tables so that vdp_plot_hires() and vdp_plot_color() do not have to read VRAM.
+ * The buffers are filled from VRAM when set and cleared by vdp_init().
+ *
+ * @param patterns VDP_G2_SHADOW_SIZE bytes owned by the caller, NULL to disable the shadow
+ * @param colors VDP_G2_SHADOW_SIZE bytes owned by the caller, NULL to disable the shadow. Both are needed, if either is NULL neither is used
+ */
+void vdp_set_g2_shadow(uint8_t* patterns, uint8_t* colors);
+
+/**
+ * @brief Print text in Graphics mode2 by name table writes instead of copying each glyph into the bitmap.
+ * The font is loaded into pattern slots VDP_G2_FONT_SLOT-255 of all three thirds, so vdp_write() writes a single byte.
+ * The cells of the other slots keep their own pattern for bitmap drawing: pixel rows 0-39, 64-103 and 128-167.
+ * Plotting skips the rows of the font slots. The font uses the colors of vdp_textcolor(), vdp_colorize() does nothing.
+ * Cleared by vdp_init().
+ *
+ * @param enabled true: load the font and print with tiles, false: remove the font and go back to bitmap text
+ * @returns VDP_ERROR if not in Graphics mode2 | VDP_OK
+ */
+int vdp_set_g2_text_tiles(bool enabled);
+
+/**
+ * @brief Defer plotting until vdp_flush() is called.
+ * While deferred, vdp_plot_color() and vdp_plot_hires() only update the RAM shadow of the current mode
+ * and mark the changed 8 byte patterns. Without a shadow for the current mode plots are written immediately.
+ *
+ * @param deferred true: defer plots, false: flush pending plots and write immediately again
+ */
+void vdp_set_deferred(bool deferred);
+
+/**
+ * @brief Copy all patterns changed since the last flush from the RAM shadow to VRAM.
+ * Each run of neighboring changed patterns is sent as one block with a single address set.
+ */
+void vdp_flush();
+
+/**
+ * @brief Wait for the start of the next vertical blanking period
+ */
+void vdp_wait_vblank();
+
+/**
+ * @brief Draw on a hidden pattern table and show it with vdp_present().
+ * Multicolor mode only, the Graphics II pattern and color tables do not fit twice into 16k VRAM.
+ * The hidden page is allocated as the VDP_BACK_PAGE region and starts as a copy of the visible one.
+ * vdp_init() turns double buffering off.
+ *
+ * @param enabled true: draw on the hidden page, false: draw on the visible page again
+ * @returns VDP_ERROR | VDP_OK
+ */
+int vdp_set_double_buffer(bool enabled);
+
+/**
+ * @brief Start drawing a frame on the hidden page.
+ * With a RAM shadow, patterns changed in the previous frame are copied to the hidden page first,
+ * so only the changes of the new frame have to be drawn.
+ */
+void vdp_begin_frame();
+
+/**
+ * @brief Flush pending plots and show the hidden page by switching the pattern table during vertical blank.
+ * Without double buffering this is the same as vdp_flush()
+ */
+void vdp_present();
+
+/**
+ * @brief Turn the VDP frame interrupt on or off.
+ * vdp_interrupt() has to be installed as the handler of the VDP interrupt, see nabu_set_interrupt_handler().
+ * While enabled, only the interrupt handler reads the status register and all VDP access of the main program
+ * has to go through the functions of this library.
+ *
+ * @param enabled
+ */
+void vdp_enable_interrupt(bool enabled);
+
+/**
+ * @brief VDP interrupt handler. Acknowledges the interrupt, counts the frame and runs the queued commands
+ * unless the main program is in the middle of a VRAM transfer, in which case they run on the next frame.
+ */
+void vdp_interrupt();
+
+/**
+ * @brief Set a function for vdp_interrupt() to call once per frame after the queued commands, e.g. sound_tick().
+ * It runs with interrupts disabled and must not access the VDP itself.
+ *
+ * @param handler NULL for none
+ */
+void vdp_set_frame_handler(void (*handler)(void));
+
+/**
+ * @brief Get the VDP status register.
+ * With the frame interrupt enabled, this is the value read by the last interrupt
+ *
+ * @returns VDP_FLAG_FRAME | VDP_FLAG_S5 | VDP_FLAG_COIN and the number of the 5th sprite
+ */
+uint8_t vdp_get_status();
+
+/**
+ * @brief Get the number of frame interrupts handled, wraps around after 255
+ */
+uint8_t vdp_get_frame_count();
+
+/**
+ * @brief Queue a register write for the next frame interrupt. Does not block.
+ *
+ * @param reg Register index 0-7
+ * @param value
+ * @returns false if the queue is full
+ */
+bool vdp_queue_register(uint8_t reg, uint8_t value);
+
+/**
+ * @brief Queue a VRAM write of up to VDP_QUEUE_MAX_WRITE bytes for the next frame interrupt.
+ * The data is copied into the queue. Does not block.
+ *
+ * @param addr VRAM address
+ * @param src Data to write
+ * @param len Number of bytes
+ * @returns false if the queue is full or len is too large
+ */
+bool vdp_queue_write(uint16_t addr, const uint8_t* src, uint8_t len);
+
+/**
+ * @brief Queue a sprite move for the next frame interrupt, so that the sprite never moves in the middle of a frame.
+ * Does not block.
+ *
+ * @param handle Sprite Handle returned by vdp_sprite_init()
+ * @param x
+ * @param y
+ * @returns false if the queue is full
+ */
+bool vdp_queue_sprite_position(uint16_t handle, uint16_t x, uint8_t y);
+
+void writeByteToVRAM(unsigned char value) VDP_FASTCALL;
 
 uint8_t readByteFromVRAM();
 
-void writePort(unsigned char value);
+void writePort(unsigned char value) VDP_FASTCALL;
+
+/**
+ * @brief Copy a block of bytes from RAM into VRAM using the auto-incrementing address register
+ *
+ * @param addr VRAM start address
+ * @param src Source buffer
+ * @param len Number of bytes to copy
+ */
+void vdp_write_block(uint16_t addr, const uint8_t* src, uint16_t len);
+
+/**
+ * @brief Copy a block of bytes from VRAM into RAM
+ *
+ * @param addr VRAM start address
+ * @param dst Destination buffer, at least len bytes
+ * @param len Number of bytes to copy
+ */
+void vdp_read_block(uint16_t addr, uint8_t* dst, uint16_t len);
+
+/**
+ * @brief Start writing VRAM at addr one byte at a time with writeByteToVRAM(), for data that arrives piece by piece,
+ * e.g. hcca_stream_to_vram(). The frame interrupt leaves the VDP alone until vdp_stream_end().
+ * The RAM shadows and dirty tracking do not see these writes
+ *
+ * @param addr VRAM start address
+ */
+void vdp_stream_begin(uint16_t addr);
+
+/**
+ * @brief End the VRAM write started by vdp_stream_begin()
+ */
+void vdp_stream_end();
+
+/**
+ * @brief Set a block of VRAM to a single value
+ *
+ * @param addr VRAM start address
+ * @param value Value to write
+ * @param len Number of bytes to write
+ */
+void vdp_fill(uint16_t addr, uint8_t value, uint16_t len);
+
+/**
+ * @brief Unpack data made by tools/vdp_pack.py straight into VRAM, without a RAM buffer for the unpacked data
+ *
+ * @param addr VRAM start address
+ * @param packed Array written by vdp_pack.py
+ */
+void vdp_decompress_to_vram(uint16_t addr, const uint8_t* packed);
 
 /**
  * @brief Print string at current cursor position. These Escape sequences are supported:
@@ -210,6 +713,16 @@ void vdp_write(uint8_t chr, bool advanceNextChar);
  */
 void vdp_set_sprite_pattern(uint8_t name, const uint8_t* sprite);
 
+/**
+ * @brief Let sprite names first to last show an already uploaded pattern, so that the same pattern does not
+ * have to be written for each of them. Applies to names set afterwards. Reset by clearing VDP_TABLE_SPRITE_PATTERNS.
+ *
+ * @param first
+ * @param last Inclusive
+ * @param pattern Name the pattern was uploaded to with vdp_set_sprite_pattern()
+ */
+void vdp_alias_sprite_patterns(uint8_t first, uint8_t last, uint8_t pattern);
+
 /**
  * @brief Set the sprite color
  *
@@ -226,6 +739,88 @@ void vdp_sprite_color(uint16_t handle, uint8_t color);
  */
 // Sprite_attributes vdp_sprite_get_attributes(uint16_t handle);
 
+/**
+ * @brief Move a sprite in the RAM copy of the sprite attribute table. Sent to VRAM by vdp_sprite_commit()
+ *
+ * @param handle Sprite Handle returned by vdp_sprite_init()
+ * @param x
+ * @param y
+ */
+void vdp_sprite_move(uint16_t handle, uint16_t x, uint8_t y);
+
+/**
+ * @brief Set the sprite color in the RAM copy of the sprite attribute table. Sent to VRAM by vdp_sprite_commit()
+ *
+ * @param handle Sprite Handle returned by vdp_sprite_init()
+ * @param color
+ */
+void vdp_sprite_set_color(uint16_t handle, uint8_t color);
+
+/**
+ * @brief Set the sprite pattern in the RAM copy of the sprite attribute table. Sent to VRAM by vdp_sprite_commit()
+ *
+ * @param handle Sprite Handle returned by vdp_sprite_init()
+ * @param name Number of the sprite as defined in vdp_set_sprite_pattern()
+ */
+void vdp_sprite_set_name(uint16_t handle, uint8_t name);
+
+/**
+ * @brief Send all sprites changed by vdp_sprite_move(), vdp_sprite_set_color() and vdp_sprite_set_name()
+ * to VRAM as one block. With the frame interrupt enabled the block is queued for the next frame.
+ */
+void vdp_sprite_commit();
+
+/**
+ * @brief Add a logical sprite to the sprite multiplexer.
+ * The multiplexer shows up to VDP_MAX_OBJECTS sprites with the 32 hardware sprites and takes over the whole
+ * sprite attribute table, so it should not be mixed with vdp_sprite_init(). The new sprite is placed below
+ * the screen until it is moved.
+ *
+ * @param name Number of the sprite as defined in vdp_set_sprite_pattern()
+ * @param color
+ * @returns Object id, VDP_NO_OBJECT if all are in use
+ */
+uint8_t vdp_object_add(uint8_t name, uint8_t color);
+
+/**
+ * @brief Remove a logical sprite from the sprite multiplexer
+ *
+ * @param id Object id returned by vdp_object_add()
+ */
+void vdp_object_remove(uint8_t id);
+
+/**
+ * @brief Move a logical sprite. Shown by the next vdp_objects_update()
+ *
+ * @param id Object id returned by vdp_object_add()
+ * @param x Same range as vdp_sprite_set_position()
+ * @param y
+ */
+void vdp_object_move(uint8_t id, uint16_t x, uint8_t y);
+
+/**
+ * @brief Set the color of a logical sprite. Shown by the next vdp_objects_update()
+ *
+ * @param id Object id returned by vdp_object_add()
+ * @param color
+ */
+void vdp_object_set_color(uint8_t id, uint8_t color);
+
+/**
+ * @brief Set the pattern of a logical sprite. Shown by the next vdp_objects_update()
+ *
+ * @param id Object id returned by vdp_object_add()
+ * @param name Number of the sprite as defined in vdp_set_sprite_pattern()
+ */
+void vdp_object_set_name(uint8_t id, uint8_t name);
+
+/**
+ * @brief Assign the logical sprites to hardware sprites and upload the sprite attribute table as one block.
+ * Call once per frame. Sprites are sorted by y. When the VDP reports a 5th sprite on a line, or there are more
+ * than 32 logical sprites, the priorities rotate so that the sprites left out take turns instead of disappearing.
+ */
+void vdp_objects_update();
+
 /// <summary>
 /// Add a new line (move down and to line start)
 /// </summary>
@@ -262,6 +857,27 @@ void vdp_ScrollTextUp(uint8_t topRow, uint8_t bottomRow);
 /// </summary>
 void vdp_ClearRows(uint8_t topRow, uint8_t bottomRow);
 
+/// <summary>
+/// Write len bytes to the console in text mode or Graphics I. Characters only go to _textBuffer and
+/// the rows they change are written to VRAM by vdp_console_flush(), so a fast stream costs one
+/// block write per frame instead of an address set per character. Handles \r, \n, \b and
+/// ESC [ sequences: m for colors (30-37, 40-47, 90-97, 100-107, 0), 2J to clear, H to move the cursor.
+/// Colors apply to the whole screen, see vdp_textcolor(). While vdp_enable_interrupt() is on the frame
+/// interrupt writes up to VDP_CONSOLE_IRQ_ROWS changed rows per frame. Without it call vdp_console_flush()
+/// to show the text, only a write that leaves every row changed flushes by itself.
+/// </summary>
+void vdp_console_write(const uint8_t* text, uint16_t len);
+
+/// <summary>
+/// Write the console rows changed since the last flush to VRAM
+/// </summary>
+void vdp_console_flush();
+
+/// <summary>
+/// Clear the console and move the cursor home, shown by the next vdp_console_flush()
+/// </summary>
+void vdp_console_clear();
+
 /// <summary>
 /// Write a character at the specified location
 /// </summary>
@@ -280,13 +896,13 @@ void vdp_writeInt8(int8_t v);
 void vdp_writeUInt8ToBinary(uint8_t v);
 
 /**
- * @brief Get the current position of a sprite
+ * @brief Get the current position of a sprite from the RAM copy of the sprite attribute table
  *
  * @param handle Sprite Handle returned by vdp_sprite_init()
  * @param xpos Reference to x-position
  * @param ypos Reference to y-position
  */
-void vdp_sprite_get_position(uint16_t handle, uint16_t xpos, uint8_t ypos);
+void vdp_sprite_get_position(uint16_t handle, uint16_t* xpos, uint8_t* ypos);
 
 /**
  * @brief Activate a sprite
@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+#
+# vdp_pack.py - Compress pattern, font and screen data for vdp_decompress_to_vram()
+#
+# Usage:   python3 ./vdp_pack.py NAME INPUT [-o OUTPUT]
+#          python3 ./vdp_pack.py NAME INPUT --array ARRAY [-o OUTPUT]
+#
+# * INPUT is a binary file, or with --array a C file holding "ARRAY[...] = { ... };"
+# * Writes "const uint8_t NAME[] = { ... };" to OUTPUT, or to stdout
+#
+# Example:
+#          Pack the font of patterns.h
+#          python3 ../../tools/vdp_pack.py ASCII_packed patterns.h --array ASCII -o patterns_packed.h
+#
+# Format: 2 byte unpacked size (lsb first), followed by an LZ4 block. Each sequence is a token
+# (high nibble literal count, low nibble match length - 4, 15 meaning more length bytes follow,
+# each adding 0-255, until one is not 255), the literals, then a 2 byte match offset (lsb first).
+# The last sequence has literals only. Matches copy from already unpacked bytes, so the Z80 side
+# can unpack straight into VRAM.
+
+import argparse
+import os
+import re
+import sys
+
+MIN_MATCH = 4
+MAX_OFFSET = 0xFFFF
+MAX_CANDIDATES = 256
+
+
+def read_c_array(path, name):
+    with open(path) as f:
+        source = f.read()
+
+    # Drop comments, patterns.h keeps an alternative font commented out
+    source = re.sub(r"/\*.*?\*/", "", source, flags=re.S)
+    source = re.sub(r"//[^\n]*", "", source)
+
+    match = re.search(r"\b" + re.escape(name) + r"\s*\[[^\]]*\]\s*=\s*\{(.*?)\}", source, re.S)
+    if match is None:
+        sys.exit("{}: no array {}".format(path, name))
+
+    return bytes(int(value, 0) & 0xFF for value in re.findall(r"0[xX][0-9a-fA-F]+|\d+", match.group(1)))
+
+
+def write_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def write_sequence(out, data, literal_start, literal_end, offset, match_len):
+    literal_len = literal_end - literal_start
+    token = min(literal_len, 15) << 4
+    if offset:
+        token |= min(match_len - MIN_MATCH, 15)
+    out.append(token)
+    if literal_len >= 15:
+        write_length(out, literal_len - 15)
+    out += data[literal_start:literal_end]
+    if offset:
+        out.append(offset & 0xFF)
+        out.append(offset >> 8)
+        if match_len - MIN_MATCH >= 15:
+            write_length(out, match_len - MIN_MATCH - 15)
+
+
+def compress(data):
+    out = bytearray([len(data) & 0xFF, len(data) >> 8])
+    positions = {}
+    literal_start = 0
+    i = 0
+
+    while i + MIN_MATCH <= len(data):
+        key = data[i:i + MIN_MATCH]
+        best_len, best_offset = 0, 0
+
+        for candidate in reversed(positions.get(key, [])[-MAX_CANDIDATES:]):
+            if i - candidate > MAX_OFFSET:
+                break
+            length = MIN_MATCH
+            while i + length < len(data) and data[candidate + length] == data[i + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_offset = length, i - candidate
+
+        if best_len < MIN_MATCH:
+            positions.setdefault(key, []).append(i)
+            i += 1
+            continue
+
+        write_sequence(out, data, literal_start, i, best_offset, best_len)
+
+        for j in range(i, i + best_len):
+            positions.setdefault(data[j:j + MIN_MATCH], []).append(j)
+
+        i += best_len
+        literal_start = i
+
+    write_sequence(out, data, literal_start, len(data), 0, 0)
+
+    return bytes(out)
+
+
+def read_length(packed, pos):
+    length = 0
+    while True:
+        value = packed[pos]
+        pos += 1
+        length += value
+        if value != 255:
+            return length, pos
+
+
+def decompress(packed):
+    size = packed[0] | (packed[1] << 8)
+    out = bytearray()
+    pos = 2
+
+    while len(out) < size:
+        token = packed[pos]
+        pos += 1
+        literal_len = token >> 4
+        if literal_len == 15:
+            extra, pos = read_length(packed, pos)
+            literal_len += extra
+        out += packed[pos:pos + literal_len]
+        pos += literal_len
+        if len(out) >= size:
+            break
+        offset = packed[pos] | (packed[pos + 1] << 8)
+        pos += 2
+        match_len = (token & 0x0F) + MIN_MATCH
+        if token & 0x0F == 15:
+            extra, pos = read_length(packed, pos)
+            match_len += extra
+        for _ in range(match_len):
+            out.append(out[-offset])
+
+    return bytes(out)
+
+
+def to_c(name, data, packed, source):
+    guard = re.sub(r"\W", "_", name).upper() + "_H"
+    lines = [
+        "// Generated by vdp_pack.py from {}, {} bytes packed to {}".format(source, len(data), len(packed)),
+        "#ifndef {}".format(guard),
+        "#define {}".format(guard),
+        "",
+        "const uint8_t {}[{}] = {{".format(name, len(packed)),
+    ]
+    for i in range(0, len(packed), 16):
+        lines.append("  " + ", ".join("0x{:02x}".format(b) for b in packed[i:i + 16]) + ",")
+    lines += ["};", "", "#endif", ""]
+    return "\n".join(lines)
+
+
+parser = argparse.ArgumentParser()
+parser.add_argument("name", help="name of the C array to write")
+parser.add_argument("input", help="binary file, or C file with --array")
+parser.add_argument("--array", help="name of the array to read from a C file")
+parser.add_argument("-o", "--output", help="header file to write, stdout if not given")
+args = parser.parse_args()
+
+if args.array:
+    data = read_c_array(args.input, args.array)
+else:
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+if len(data) > 0x4000:
+    sys.exit("{}: {} bytes do not fit into VRAM".format(args.input, len(data)))
+
+packed = compress(data)
+
+if decompress(packed) != data:
+    sys.exit("{}: packed data does not unpack to the input".format(args.input))
+
+text = to_c(args.name, data, packed, os.path.basename(args.input))
+
+if args.output:
+    with open(args.output, "w") as f:
+        f.write(text)
+else:
+    sys.stdout.write(text)
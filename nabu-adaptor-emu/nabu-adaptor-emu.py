@@ -2,11 +2,12 @@
 #
 # NABU Adaptor Emulator - Copyright Mike Debreceni - 2022
 #
-# Usage:   python3 ./nabu-adaptor-emu.py  [--ttyname TTYNAME] [--baudrate BAUDRATE]
+# Usage:   python3 ./nabu-adaptor-emu.py  [--ttyname TTYNAME] [--baudrate BAUDRATE] [--files FILES]
 #
 # * If ttyname is passed, listen on serial port as well as TCP
 # * if ttyname is not passed, listen only on TCP (port 5816)
 # * if baud rate is not specified, DEFAULT_BAUD_RATE is 111863
+# * files is the directory served by the file requests, DEFAULT_FILES_DIR if not specified
 #
 # Example:
 #          TCP and serial via /dev/ttyUSB0
@@ -21,6 +22,8 @@
 # menu is 000001.pak, other files all upercase hex names with .pak extension
 
 import argparse
+import mmap
+import os
 import serial
 import time
 import datetime
@@ -31,6 +34,14 @@ import serial_asyncio
 
 NABU_STATE_AWAITING_REQ = 0
 NABU_STATE_PROCESSING_REQ = 1
+
+BULK_ACK = 0x06
+BULK_RESEND = 0x15
+
+NO_FILE = 0xff
+MAX_FILES = 16
+# Differing runs closer than this are sent as one, a run costs 4 bytes
+DELTA_GAP = 4
 MAX_READ=65535
 
 # request type
@@ -53,6 +64,27 @@ MAX_READ=65535
 # $97   Unload XIOS Module
 # $99   Resolve Global Reference
 
+# Added by this emulator for homebrew programs, see nabu.c
+#
+# $a0   Bulk download segment: NPC sends the segment ID (lsb first), the first pack number
+#       and a window size. The packs are streamed back to back, each one escaped together
+#       with its pack number in front and ended by $10 $e1. The NPC replies to each pack
+#       with $06 (ack) or $15 (resend) and the number of the next pack it expects. An ack
+#       covers all packs before that number, a resend starts the stream over from it.
+#       Anything else cancels the download.
+#
+# File service, read-only access to the files directory:
+#
+# $a1   Open: NPC sends the name length and name, NA replies $e4 and a handle ($ff on failure)
+# $a2   Read: NPC sends the handle, a 4 byte offset and a 2 byte length (lsb first). NA replies
+#       $e4 $91 and the escaped bytes up to $10 $e1, fewer at the end of the file, or $e4 $90
+# $a3   Size: NPC sends the handle, NA replies $e4 and the 4 byte size ($ffffffff on failure)
+# $a4   Close: NPC sends the handle, NA replies $e4
+# $a5   Delta: NPC sends the handle, the 4 byte offsets of the new and of the previous data
+#       and a 2 byte length. NA replies $e4 $91, then escaped up to $10 $e1 the runs of bytes
+#       that differ, each as its 2 byte offset, 2 byte length and bytes, ended by a run of
+#       length 0. Or $e4 $90. E.g. the next frame of a VRAM image sequence
+
 class NabuAdaptor():
     segments = {}
 
@@ -61,6 +93,9 @@ class NabuAdaptor():
         self.reader=reader
         self.writer=writer
         self.segment = None
+        self.files = {}
+        # drain() then waits until the transport sent everything, see close_file()
+        self.writer.transport.set_write_buffer_limits(0)
 
     # Loads pak from file, assumes file names are all upper case with a lower case .pak extension
     # Assumes all pak files are in a directory called paks/
@@ -114,6 +149,24 @@ class NabuAdaptor():
                         print("* Set Channel Code")
                         await self.handle_set_channel_code(data)
                         print("* Channel code is now " + channelCode)
+                    elif req_type == 0xa0:
+                        print("* Bulk Download Segment Request")
+                        await self.handle_bulk_download_segment(data)
+                    elif req_type == 0xa1:
+                        print("* File Open")
+                        await self.handle_file_open(data)
+                    elif req_type == 0xa2:
+                        print("* File Read")
+                        await self.handle_file_read(data)
+                    elif req_type == 0xa3:
+                        print("* File Size")
+                        await self.handle_file_size(data)
+                    elif req_type == 0xa4:
+                        print("* File Close")
+                        await self.handle_file_close(data)
+                    elif req_type == 0xa5:
+                        print("* File Delta")
+                        await self.handle_file_delta(data)
                     elif req_type == 0x8f:
                         print("* Handle 0x8f")
                         await self.handle_0x8f_req(data)
@@ -132,6 +185,8 @@ class NabuAdaptor():
                 connected = False
                 print("Connection reset by peer.")
 
+        for handle in list(self.files):
+            await self.close_file(handle)
         print("Closing session.")
 
 
@@ -262,6 +317,175 @@ class NabuAdaptor():
             await self.sendBytes(escaped_pack_data)
             await self.sendBytes(bytes([0x10, 0xe1]))
 
+    async def handle_bulk_download_segment(self, data):
+        await self.send_ack()
+        data = await self.recvBytesExactLen(5)
+        segmentId = str(bytes(reversed(data[0:3])).hex())
+        firstPack = data[3]
+        window = max(1, data[4])
+        print("* Requested Segment ID: " + segmentId)
+        print("* First pack: {}, window: {}".format(firstPack, window))
+
+        try:
+            if segmentId not in NabuAdaptor.segments:
+                self.loadpak(segmentId)
+        except OSError as e:
+            print("* Segment not available: {}".format(e))
+            await self.sendBytes(bytes([0xe4, 0x90]))
+            return
+
+        segment = NabuAdaptor.segments[segmentId]
+        packCount = segment.get_pack_count()
+        await self.sendBytes(bytes([0xe4, 0x91]))
+
+        # Go-back-N: keep up to window packs ahead of the cumulative acknowledgement
+        base = firstPack
+        nextPack = firstPack
+        while base < packCount:
+            while nextPack < packCount and nextPack - base < window:
+                frame = bytes([nextPack & 0xff]) + segment.get_pack(nextPack)
+                await self.sendBytes(self.escapeUploadBytes(frame) + bytes([0x10, 0xe1]))
+                nextPack += 1
+
+            reply = await self.recvBytesExactLen(2)
+            expected = base + ((reply[1] - base) & 0xff)
+            if reply[0] == BULK_ACK:
+                base = max(base, min(expected, nextPack))
+            elif reply[0] == BULK_RESEND:
+                print("* Resending from pack {}".format(expected))
+                base = expected
+                nextPack = expected
+            else:
+                print("* Bulk download cancelled by NPC")
+                return
+
+        print("* Bulk download of {} packs done".format(packCount - firstPack))
+
+    # Maps a file of the files directory, None if the name leads outside of it or can't be opened
+    def open_file(self, name):
+        root = os.path.realpath(args.files)
+        path = os.path.realpath(os.path.join(root, name))
+        if os.path.commonpath([root, path]) != root or not os.path.isfile(path):
+            return None
+        with open(path, "rb") as f:
+            if os.fstat(f.fileno()).st_size == 0:
+                return b""
+            return mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+    # Unmaps a file once the transport is done with the slices of it that write_escaped() handed over
+    async def close_file(self, handle):
+        data = self.files.pop(handle)
+        if isinstance(data, mmap.mmap):
+            try:
+                await self.writer.drain()
+            except ConnectionError:
+                # The session is gone, the transport dropped what it still held
+                pass
+            data.close()
+
+    async def handle_file_open(self, data):
+        await self.send_ack()
+        length = (await self.recvBytesExactLen(1))[0]
+        name = (await self.recvBytesExactLen(length)).decode("ascii", "replace")
+        print("* Open file: " + name)
+
+        handle = NO_FILE
+        free = [h for h in range(MAX_FILES) if h not in self.files]
+        if free:
+            try:
+                data = self.open_file(name)
+            except (OSError, ValueError) as e:
+                print("* Can't open {}: {}".format(name, e))
+                data = None
+            if data is not None:
+                handle = free[0]
+                self.files[handle] = data
+        print("* Handle: {}".format(handle))
+        await self.sendBytes(bytes([0xe4, handle]))
+
+    async def handle_file_read(self, data):
+        await self.send_ack()
+        request = await self.recvBytesExactLen(7)
+        handle = request[0]
+        offset = int.from_bytes(request[1:5], "little")
+        length = int.from_bytes(request[5:7], "little")
+        if handle not in self.files:
+            await self.sendBytes(bytes([0xe4, 0x90]))
+            return
+        await self.sendBytes(bytes([0xe4, 0x91]))
+
+        data = self.files[handle]
+        end = min(offset + length, len(data))
+        await self.write_escaped(data, min(offset, end), end)
+        print("* Sent {} bytes at offset {}".format(max(0, end - offset), offset))
+        await self.sendBytes(bytes([0x10, 0xe1]))
+
+    async def handle_file_delta(self, data):
+        await self.send_ack()
+        request = await self.recvBytesExactLen(11)
+        handle = request[0]
+        offset = int.from_bytes(request[1:5], "little")
+        previous = int.from_bytes(request[5:9], "little")
+        length = int.from_bytes(request[9:11], "little")
+        if handle not in self.files:
+            await self.sendBytes(bytes([0xe4, 0x90]))
+            return
+        await self.sendBytes(bytes([0xe4, 0x91]))
+
+        data = self.files[handle]
+        length = max(0, min(length, len(data) - offset, len(data) - previous))
+        new = memoryview(data)[offset:offset + length]
+        old = memoryview(data)[previous:previous + length]
+
+        runs = []
+        index = 0
+        while index < length:
+            if new[index] == old[index]:
+                index += 1
+                continue
+            start = index
+            same = 0
+            while index < length and same < DELTA_GAP:
+                same = same + 1 if new[index] == old[index] else 0
+                index += 1
+            runs.append((start, index - same))
+
+        sent = 0
+        for start, end in runs:
+            await self.sendBytes(self.escapeUploadBytes(start.to_bytes(2, "little") + (end - start).to_bytes(2, "little")))
+            await self.write_escaped(data, offset + start, offset + end)
+            sent += end - start
+        await self.sendBytes(bytes(4))
+        print("* Sent {} runs, {} of {} bytes".format(len(runs), sent, length))
+        await self.sendBytes(bytes([0x10, 0xe1]))
+
+    # Sends data[start:end] escaped. Slices of a mapping go to the transport as they are, without a copy, and
+    # each 0x10 gets a second one. The transport may hold on to them, close_file() waits for it before unmapping
+    async def write_escaped(self, data, start, end):
+        view = memoryview(data)
+        index = start
+        while index < end:
+            escape = data.find(b"\x10", index, end)
+            if escape < 0:
+                await self.sendBytes(view[index:end])
+                break
+            await self.sendBytes(view[index:escape + 1])
+            await self.sendBytes(b"\x10")
+            index = escape + 1
+
+    async def handle_file_size(self, data):
+        await self.send_ack()
+        handle = (await self.recvBytesExactLen(1))[0]
+        size = len(self.files[handle]) if handle in self.files else 0xffffffff
+        await self.sendBytes(bytes([0xe4]) + size.to_bytes(4, "little"))
+
+    async def handle_file_close(self, data):
+        await self.send_ack()
+        handle = (await self.recvBytesExactLen(1))[0]
+        if handle in self.files:
+            await self.close_file(handle)
+        await self.sendBytes(bytes([0xe4]))
+
     async def handle_set_channel_code(self, data):
         global channelCode
         await self.send_ack()
@@ -343,6 +567,7 @@ class NabuAdaptor():
 ######  Begin main code here
 
 DEFAULT_BAUDRATE=111863
+DEFAULT_FILES_DIR="files"
 # channelCode = None
 channelCode = '0000'
 
@@ -355,6 +580,10 @@ parser.add_argument("-b", "--baudrate",
         type=int,
         help="Set serial baud rate (default: {} BPS)".format(DEFAULT_BAUDRATE),
         default=DEFAULT_BAUDRATE)
+# Optional argument for the directory of the file service
+parser.add_argument("-f", "--files",
+        help="Set directory served to NABU programs (default: {})".format(DEFAULT_FILES_DIR),
+        default=DEFAULT_FILES_DIR)
 args = parser.parse_args()
 
 # TODO: We should change this to handle .nabu files instead, which have not yet been split into packets with headers and checksums